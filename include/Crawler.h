@@ -0,0 +1,33 @@
+#ifndef CRAWLER_H
+#define CRAWLER_H
+
+#include "FBGraph.h"
+#include "WorkQueue.h"
+
+#include <mutex>
+#include <string>
+
+// Fetches the data that is most likely to be needed right after mounting, so
+// that the first operations are served from the cache instead of waiting on
+// Facebook one miss at a time.
+class Crawler {
+    public:
+        Crawler(FBGraph&, const unsigned, const unsigned, const unsigned);
+        ~Crawler();
+        void start();
+        void stop();
+    private:
+        void enqueue(const unsigned, const WorkQueue::task_t);
+        void crawl_self();
+        void crawl_friend(const std::string&);
+
+        FBGraph &graph;
+        unsigned max_depth;
+
+        std::mutex budget_mutex;
+        unsigned budget;
+
+        WorkQueue queue;
+};
+
+#endif // CRAWLER_H
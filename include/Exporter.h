@@ -0,0 +1,68 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include "FBGraph.h"
+#include "FBQuery.h"
+#include "WorkQueue.h"
+
+#include <boost/filesystem.hpp>
+#include "json_spirit.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Copies the user's statuses and albums, and those of their friends, into a
+// directory laid out like the mount. Listings are fetched page by page by a
+// pool of workers, and each page is written out as soon as it arrives, so
+// memory use doesn't grow with the size of the account.
+//
+// The position reached in each listing is recorded in a progress file inside
+// the directory, so an interrupted export continues where it stopped.
+class Exporter {
+    public:
+        Exporter(FBGraph&, const std::string&, const unsigned);
+        int run();
+    private:
+        class Listing {
+            public:
+                std::string key;
+                FBQuery query;
+                boost::filesystem::path directory;
+                bool is_albums;
+        };
+
+        void load_progress();
+        bool record_progress(const std::string&, const std::string&);
+        void add_listing(const std::string&, const std::string&,
+                const boost::filesystem::path&);
+        void export_friends();
+        void export_page(const Listing, const std::string&);
+        bool write_status(const boost::filesystem::path&, const json_spirit::mObject&);
+        bool write_album(const boost::filesystem::path&, const json_spirit::mObject&);
+        void report();
+
+        FBGraph &graph;
+        boost::filesystem::path root;
+        WorkQueue queue;
+
+        // The cursor of the next page of each listing, or "done"
+        std::map<std::string, std::string> progress;
+        std::mutex progress_mutex;
+        int progress_fd;
+
+        std::atomic<unsigned long> requests;
+        std::atomic<unsigned long> items;
+        std::atomic<unsigned long> bytes;
+        std::atomic<unsigned long> failures;
+        std::chrono::steady_clock::time_point start_time;
+
+        std::mutex report_mutex;
+        std::condition_variable finished;
+        bool done;
+};
+
+#endif // EXPORTER_H
@@ -2,11 +2,22 @@
 #define FBGRAPH_H
 
 #include "FBQuery.h"
+#include "PublicCache.h"
+#include "SearchIndex.h"
+#include "Store.h"
+#include "Transport.h"
 
 #include <boost/optional.hpp>
 #include "json_spirit.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <functional>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
 
 typedef std::map<
@@ -16,32 +27,134 @@ typedef std::map<
 
 typedef std::map<std::string, json_spirit::mObject> fql_cache_t;
 
+// The type of errors that fbfs reports when it didn't get a response from
+// Facebook, and their codes
+extern const std::string TRANSPORT_ERROR_TYPE;
+
+enum transport_error_code {
+    TRANSPORT_FAILED = 0,
+    TRANSPORT_TIMED_OUT = 1,
+    TRANSPORT_INTERRUPTED = 2,
+};
+
 class FBGraph {
     public:
-        FBGraph();
+        FBGraph(std::shared_ptr<Transport> = std::make_shared<Transport>(),
+                std::shared_ptr<PublicCache> = std::make_shared<PublicCache>());
         bool is_logged_in() const;
         void set_logged_in(const bool) noexcept;
-        void set_access_token(const std::string&) noexcept;
+        void set_access_token(const std::string&);
+        std::string get_access_token() const;
+        bool validate_access_token();
+        void set_graph_url(const std::string&) noexcept;
+        Transport& get_transport() noexcept;
+        void set_interrupt_check(const std::function<bool()>);
+        void set_listing_ttl(const std::chrono::seconds) noexcept;
+        void set_reconcile_interval(const std::chrono::seconds) noexcept;
         boost::optional<std::string>
             parse_login_response(const std::string, const std::string,
                 const std::string, const std::map<std::string, std::string>,
                 const std::string) const noexcept;
         void login(std::vector<std::string>&, std::vector<std::string>&);
         json_spirit::mObject get(const FBQuery&, const bool = false);
+        json_spirit::mObject fetch(const FBQuery&);
         json_spirit::mObject post(const FBQuery&);
         json_spirit::mValue del(const FBQuery&);
         std::string get_endpoint_for_permission(const std::string&) const;
         json_spirit::mObject fql_get(const std::string&, const bool = false);
+        json_spirit::mObject list_statuses(const std::string&,
+                std::vector<std::string>&, const bool = false);
+        json_spirit::mObject stat_status(const std::string&, time_t&,
+                std::size_t&, const bool = false);
+        json_spirit::mObject read_status(const std::string&, char*, std::size_t,
+                std::size_t, std::size_t&, const bool = false);
+        boost::optional<uint32_t> get_status_version(const std::string&);
+        std::vector<std::string> search_statuses(const std::string&);
+        uint64_t get_listing_generation() const;
+        json_spirit::mObject list_albums(const std::string&, std::vector<std::string>&);
+        json_spirit::mObject stat_album(const std::string&, const std::string&, time_t&);
+        json_spirit::mObject start_photo_upload(const std::string&, const std::string&,
+                const std::string&, std::unique_ptr<Upload>&);
+        json_spirit::mObject finish_photo_upload(Upload&);
+        json_spirit::mObject list_friends(const std::string&, std::vector<std::string>&);
+        json_spirit::mObject get_installed(const std::string&);
         std::string get_uid_from_name(std::string name);
+        bool is_friend(const std::string&);
         std::set<std::string> get_friends();
         std::string get_user();
+        void add_posted_status(const std::string&, const std::string&);
+        void remove_status(const std::string&);
+        void invalidate(const std::string&);
+        static bool is_transport_error(const json_spirit::mObject&);
+        static bool is_retryable_error(const json_spirit::mObject&);
     private:
+        // How a cached listing is brought up to date
+        enum sync_mode {
+            SYNC_NONE,
+            SYNC_INCREMENTAL,
+            SYNC_FULL,
+        };
+
+        // The newest update time in a cached listing, and when the listing
+        // was last checked for newer objects and last fetched in full
+        class ListingSync {
+            public:
+                int64_t newest_time;
+                std::chrono::steady_clock::time_point synced;
+                std::chrono::steady_clock::time_point reconciled;
+        };
+
         json_spirit::mValue parse_response(const std::string&);
         std::string send_request(const std::string&, const FBQuery&);
+        std::string make_url(const FBQuery&) const;
+        std::string get_body(const Response&);
+        json_spirit::mObject load_status(const std::string&, const bool);
+        Table::row_t put_status(const std::string&, const int64_t, const std::string&);
+        json_spirit::mObject sync_statuses(const std::string&, const bool);
+        json_spirit::mObject load_statuses(const std::string&, const bool);
+        json_spirit::mObject sync_albums(const std::string&);
+        json_spirit::mObject load_albums(const std::string&, const bool);
+        sync_mode get_sync_mode(const std::map<std::string, ListingSync>&,
+                const Table&, const std::string&) const;
+        int64_t get_since(const std::map<std::string, ListingSync>&, const std::string&) const;
+        void record_sync(std::map<std::string, ListingSync>&, const std::string&,
+                const int64_t, const bool);
+        void merge_listing(Table&, const std::string&, const std::vector<Table::row_t>&,
+                const bool);
+        json_spirit::mObject load_own_friends();
+
+        // Only for queries whose answer can't depend on who asks, since it is
+        // shared with every other account in the PublicCache
+        json_spirit::mObject get_public(const FBQuery&);
+        bool has_listing(const Table&, const std::string&);
+        boost::optional<Table::row_t> find_row(const Table&, const std::string&);
         bool logged_in;
         std::string access_token;
+        std::string graph_url;
+        std::shared_ptr<Transport> transport;
+
+        // Responses that don't depend on the account may be shared with
+        // other mounts, everything else is kept in request_cache
+        std::shared_ptr<PublicCache> public_cache;
         request_cache_t request_cache;
         fql_cache_t fql_cache;
+
+        // Statuses, friends and albums are kept in compact tables rather
+        // than as the JSON they were parsed from
+        StringArena arena;
+        StatusTable statuses;
+        FriendTable friends;
+        AlbumTable albums;
+
+        // Every status message that has been fetched, by word
+        SearchIndex search_index;
+
+        std::map<std::string, ListingSync> status_syncs;
+        std::map<std::string, ListingSync> album_syncs;
+        std::chrono::seconds listing_ttl;
+        std::chrono::seconds reconcile_interval;
+        std::atomic<uint64_t> listing_generation;
+        std::mutex cache_mutex;
 };
 
 #endif // FBGRAPH_H
@@ -0,0 +1,82 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "FBGraph.h"
+
+#include <boost/optional.hpp>
+
+#include <condition_variable>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+class JournalEntry {
+    public:
+        // The name under which a pending post is listed
+        std::string get_pending_name() const;
+
+        unsigned long sequence;
+        std::string operation;
+        time_t time;
+
+        // The message of a post, or the ID of the status to delete
+        std::string argument;
+};
+
+// Records posts and deletions in a local log before they are sent to
+// Facebook, so that they can be acknowledged as soon as they are on disk. A
+// background worker applies them in order, and anything that wasn't applied
+// when fbfs exited is applied the next time it is mounted.
+//
+// A post whose response was lost, or that was replayed after fbfs died, may
+// already be on Facebook. Before sending it again, the worker looks for a
+// recent status with the same message, and takes that for the post.
+//
+// Entries are only dropped when Facebook refuses them for good. Outages, rate
+// limits and expired tokens keep them in the journal, to be retried with
+// backoff.
+class Journal {
+    public:
+        Journal(FBGraph&, const std::string&);
+        ~Journal();
+        bool open();
+        void stop();
+        bool post(const std::string&);
+        bool remove(const std::string&);
+        bool cancel(const std::string&);
+        std::vector<JournalEntry> get_pending_posts();
+        boost::optional<JournalEntry> find_pending_post(const std::string&);
+        bool is_pending_delete(const std::string&);
+    private:
+        bool append(const JournalEntry&);
+        bool append_done(const unsigned long);
+        bool append_record(const std::string&);
+        json_spirit::mObject find_post(const JournalEntry&);
+        bool replay();
+        void run();
+        json_spirit::mObject apply(const JournalEntry&);
+        void update_cache(const JournalEntry&, const json_spirit::mObject&);
+
+        FBGraph &graph;
+        std::string path;
+        int fd;
+        unsigned long next_sequence;
+
+        std::mutex mutex;
+        std::condition_variable work_available;
+        std::deque<JournalEntry> pending;
+
+        // The entry the worker is applying, which can no longer be cancelled
+        unsigned long in_flight;
+
+        // Posts that may have reached Facebook without the journal knowing
+        std::set<unsigned long> maybe_sent;
+        bool stopping;
+        std::thread worker;
+};
+
+#endif // JOURNAL_H
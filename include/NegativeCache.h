@@ -0,0 +1,28 @@
+#ifndef NEGATIVECACHE_H
+#define NEGATIVECACHE_H
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Remembers paths that were found not to exist, for a limited time. Shells
+// and file managers look for the same missing files (such as .hidden or .git)
+// over and over, and each miss would otherwise be a request to Facebook.
+class NegativeCache {
+    public:
+        NegativeCache();
+        void set_ttl(const std::chrono::milliseconds) noexcept;
+        bool contains(const std::string&);
+        void add(const std::string&);
+        void clear();
+        void set_generation(const uint64_t);
+    private:
+        std::chrono::milliseconds ttl;
+        uint64_t generation;
+        std::mutex mutex;
+        std::unordered_map<std::string, std::chrono::steady_clock::time_point> expiry_times;
+};
+
+#endif // NEGATIVECACHE_H
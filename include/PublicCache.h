@@ -0,0 +1,32 @@
+#ifndef PUBLICCACHE_H
+#define PUBLICCACHE_H
+
+#include "FBQuery.h"
+
+#include <boost/optional.hpp>
+#include "json_spirit.h"
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+
+// Responses that are the same whoever asks for them, such as whether a user
+// has installed the app. When several accounts are mounted at once, their
+// FBGraphs share one of these so that each response is only fetched and
+// stored once.
+class PublicCache {
+    public:
+        boost::optional<json_spirit::mObject> find(const FBQuery&);
+        void put(const FBQuery&, const json_spirit::mObject&);
+        std::size_t size();
+    private:
+        typedef std::tuple<std::string, std::string, std::string, parameters_t> key_t;
+        static key_t make_key(const FBQuery&);
+
+        std::mutex mutex;
+        std::map<key_t, json_spirit::mObject> responses;
+};
+
+#endif // PUBLICCACHE_H
@@ -0,0 +1,61 @@
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+#include "Store.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The rows containing a term, in ascending order. Each row is stored as the
+// difference from the previous one in a variable-length integer, so most
+// rows take a single byte.
+class PostingList {
+    public:
+        typedef Table::row_t row_t;
+
+        PostingList();
+        void add(const row_t);
+        std::vector<row_t> get() const;
+        std::size_t size() const;
+        std::size_t memory_usage() const;
+    private:
+        void append(const row_t);
+        void merge();
+
+        std::vector<uint8_t> encoded;
+        row_t last;
+
+        // The number of rows, counting unsorted rows that are also encoded
+        // until they are merged
+        uint32_t count;
+
+        // Rows that were added after a higher row, such as statuses that
+        // were edited. They are merged into the encoded rows in batches.
+        std::vector<row_t> unsorted;
+};
+
+// An inverted index from the words in status messages to the rows of the
+// status table. Rows are only ever added, so a row whose message changed may
+// still be listed under its old words; callers check the current message
+// before using a result.
+class SearchIndex {
+    public:
+        typedef Table::row_t row_t;
+
+        explicit SearchIndex(StringArena&);
+        void add(const row_t, const std::string&);
+        std::vector<row_t> search(const std::string&) const;
+        std::size_t size() const;
+        std::size_t memory_usage() const;
+        static std::vector<std::string> tokenize(const std::string&);
+        static bool matches(const std::string&, const std::string&);
+    private:
+        StringArena &arena;
+        std::vector<StringArena::handle_t> terms;
+        std::vector<PostingList> postings;
+        RowIndex index;
+};
+
+#endif // SEARCHINDEX_H
@@ -0,0 +1,137 @@
+#ifndef STORE_H
+#define STORE_H
+
+#include <boost/optional.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Append-only storage for strings. Each string is stored once, prefixed with
+// its length, and is referred to by a 32-bit handle. Strings that are repeated
+// often (such as IDs and names) can be interned so that equal strings share a
+// handle.
+class StringArena {
+    public:
+        typedef uint32_t handle_t;
+
+        StringArena();
+        handle_t add(const std::string&);
+        handle_t intern(const std::string&);
+        boost::optional<handle_t> find(const std::string&) const;
+        std::string get(const handle_t) const;
+        std::size_t length(const handle_t) const;
+        std::size_t copy(const handle_t, char*, std::size_t, std::size_t) const;
+        bool equals(const handle_t, const std::string&) const;
+        std::size_t memory_usage() const;
+    private:
+        const char* contents(const handle_t, std::size_t&) const;
+        void grow_table();
+
+        std::vector<char> data;
+
+        // Open addressing table of interned handles, offset by one so that
+        // zero marks an empty slot
+        std::vector<handle_t> table;
+        std::size_t interned;
+};
+
+// Maps keys to rows with open addressing. The keys themselves aren't stored
+// in the index, but looked up in the key column of the table.
+class RowIndex {
+    public:
+        typedef uint32_t row_t;
+
+        RowIndex();
+        boost::optional<row_t> find(const StringArena::handle_t,
+                const std::vector<StringArena::handle_t>&) const;
+        void insert(const StringArena::handle_t, const row_t,
+                const std::vector<StringArena::handle_t>&);
+        void clear();
+        std::size_t memory_usage() const;
+    private:
+        void grow(const std::vector<StringArena::handle_t>&);
+
+        // Rows offset by one, so that zero marks an empty slot
+        std::vector<row_t> slots;
+        std::size_t count;
+};
+
+// A column-oriented table of objects keyed by their Facebook ID, along with
+// the listings of the nodes that own them, in the order Facebook returned
+// them. Removed objects keep their row but disappear from listings.
+class Table {
+    public:
+        typedef RowIndex::row_t row_t;
+
+        explicit Table(StringArena&);
+        virtual ~Table();
+        boost::optional<row_t> find(const std::string&) const;
+        void remove(const std::string&);
+        void set_listing(const std::string&, const std::vector<row_t>&);
+        void prepend_to_listing(const std::string&, const row_t);
+        void remove_listing(const std::string&);
+        bool has_listing(const std::string&) const;
+        std::vector<row_t> get_listing(const std::string&) const;
+        std::string get_key(const row_t) const;
+        std::size_t size() const;
+        virtual std::size_t memory_usage() const;
+    protected:
+        row_t find_or_add(const std::string&, bool&);
+        std::size_t string_usage(const std::vector<StringArena::handle_t>&) const;
+
+        StringArena &arena;
+        std::vector<StringArena::handle_t> keys;
+        std::vector<bool> removed;
+        RowIndex index;
+        std::map<StringArena::handle_t, std::vector<row_t>> listings;
+};
+
+class StatusTable : public Table {
+    public:
+        explicit StatusTable(StringArena&);
+        row_t put(const std::string&, const int64_t, const std::string&);
+        int64_t get_updated_time(const row_t) const;
+        std::size_t get_message_length(const row_t) const;
+        std::string get_message(const row_t) const;
+        std::size_t read_message(const row_t, char*, std::size_t, std::size_t) const;
+        uint32_t get_version(const row_t) const;
+        std::size_t memory_usage() const;
+    private:
+        std::vector<int64_t> updated_times;
+        std::vector<StringArena::handle_t> messages;
+};
+
+class FriendTable : public Table {
+    public:
+        explicit FriendTable(StringArena&);
+        row_t put(const std::string&, const std::string&);
+        void set_own_friends(const std::vector<row_t>&);
+        bool has_own_friends() const;
+        boost::optional<row_t> find_own_friend(const std::string&) const;
+        std::string get_name(const row_t) const;
+        std::size_t memory_usage() const;
+    private:
+        std::vector<StringArena::handle_t> names;
+
+        // The user's own friends, by name
+        RowIndex name_index;
+        bool own_friends_loaded;
+};
+
+class AlbumTable : public Table {
+    public:
+        explicit AlbumTable(StringArena&);
+        row_t put(const std::string&, const std::string&, const int64_t);
+        boost::optional<row_t> find_by_name(const std::string&, const std::string&) const;
+        std::string get_name(const row_t) const;
+        int64_t get_updated_time(const row_t) const;
+        std::size_t memory_usage() const;
+    private:
+        std::vector<StringArena::handle_t> names;
+        std::vector<int64_t> updated_times;
+};
+
+#endif // STORE_H
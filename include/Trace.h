@@ -0,0 +1,35 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// Records how long each stage of an operation takes, in the Chrome trace
+// event format (load the output in chrome://tracing or Perfetto). Tracing is
+// off unless enabled, in which case spans cost a single atomic load.
+class Trace {
+    public:
+        static void enable(const std::string&);
+        static bool is_enabled();
+        static bool dump();
+};
+
+// Times the scope it is declared in. The name and category must be string
+// literals; the detail, such as a path, is copied.
+class TraceSpan {
+    public:
+        TraceSpan(const char*, const char*, const char* = NULL);
+        ~TraceSpan();
+
+        static const std::size_t DETAIL_LENGTH = 48;
+    private:
+        bool active;
+        const char *name;
+        const char *category;
+        char detail[DETAIL_LENGTH];
+        std::chrono::steady_clock::time_point start;
+};
+
+#endif // TRACE_H
@@ -0,0 +1,157 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bounds the time spent on all requests made by the current thread while it
+// is in scope, such as every request needed to answer one FUSE operation.
+class OperationDeadline {
+    public:
+        explicit OperationDeadline(const std::chrono::milliseconds);
+        ~OperationDeadline();
+        static std::chrono::steady_clock::time_point current();
+        static bool is_active();
+    private:
+        std::chrono::steady_clock::time_point previous;
+};
+
+class Response {
+    public:
+        Response();
+        bool should_retry() const;
+
+        // The HTTP status code, or 0 if no response was received
+        long status;
+        std::string body;
+        std::string error;
+        bool interrupted;
+        bool timed_out;
+};
+
+class HandlePool;
+
+// Hands curl the next part of an upload's body, given as userdata. Tests call
+// it directly to read bodies the way curl does.
+std::size_t read_upload_body(char*, std::size_t, std::size_t, void*);
+
+// A POST request whose body is streamed as it's written. The data goes
+// through a fixed-size ring buffer to a curl transfer on its own thread, and
+// is sent as the only file of a chunked multipart form.
+class Upload {
+    public:
+        Upload(std::shared_ptr<HandlePool>, const std::function<bool()>,
+                const std::string&, const std::string&);
+        ~Upload();
+        void start(const std::string&, const std::chrono::milliseconds);
+        bool write(const char*, std::size_t);
+        void close();
+        Response finish();
+        void abort();
+        std::size_t size() const;
+    private:
+        friend std::size_t read_upload_body(char*, std::size_t, std::size_t, void*);
+
+        std::size_t read(char*, std::size_t);
+        void send(const std::string&, const std::chrono::milliseconds);
+        bool is_interrupted() const;
+
+        std::shared_ptr<HandlePool> handles;
+        std::function<bool()> interrupt_check;
+        std::thread transfer;
+
+        mutable std::mutex mutex;
+        std::condition_variable data_available;
+        std::condition_variable space_available;
+        std::condition_variable transfer_done;
+
+        // How long the transfer may take to connect, and to answer once the
+        // last of the data was written
+        std::chrono::milliseconds timeout;
+
+        // Written data that curl hasn't read yet
+        std::vector<char> buffer;
+        std::size_t head;
+        std::size_t used;
+        std::size_t written;
+
+        // The multipart headers before the data, and the boundary after it,
+        // along with how much of each has been read
+        std::string preamble;
+        std::string epilogue;
+        std::size_t preamble_read;
+        std::size_t epilogue_read;
+
+        // No more data will be written
+        bool closed;
+        bool aborted;
+        bool done;
+        Response response;
+
+        // Checked by curl while it's sending, when it isn't waiting for data
+        std::atomic<bool> cancelled;
+};
+
+// Sends requests to Facebook. A single transport may be shared by several
+// FBGraphs, in which case they share its connections, rate limit and
+// scheduling of interactive and background requests.
+class Transport {
+    public:
+        Transport();
+        Response perform(const std::string&, const std::string&);
+        std::unique_ptr<Upload> start_upload(const std::string&, const std::string&,
+                const std::string&, Response&);
+        void set_deadline(const std::chrono::milliseconds) noexcept;
+        void set_max_retries(const unsigned) noexcept;
+        void set_hedging(const bool) noexcept;
+        void set_max_rate(const double);
+        void set_interrupt_check(const std::function<bool()>);
+
+        // Marks requests made by the calling thread as background work, which
+        // waits for interactive requests to finish before being sent. The
+        // check tells background requests to give up, such as when the work
+        // they're part of is stopped.
+        static void set_background_thread(const bool,
+                const std::function<bool()> = std::function<bool()>());
+    private:
+        Response perform_round(const std::string&, const std::string&,
+                const std::chrono::steady_clock::time_point, const bool);
+        std::chrono::milliseconds hedge_delay();
+        std::chrono::milliseconds backoff(const unsigned);
+        void record_latency(const std::chrono::milliseconds);
+        bool wait_until(const std::chrono::steady_clock::time_point);
+        bool is_interrupted() const;
+        bool wait_for_interactive(const std::chrono::steady_clock::time_point);
+        bool wait_for_permit(const std::chrono::steady_clock::time_point);
+
+        std::chrono::milliseconds deadline;
+        unsigned max_retries;
+        bool hedging;
+        std::function<bool()> interrupt_check;
+
+        std::mutex mutex;
+        std::vector<std::chrono::milliseconds> latencies;
+        std::size_t next_latency;
+        unsigned interactive_requests;
+        std::condition_variable interactive_done;
+        std::mt19937 random;
+
+        // A token bucket limiting how many requests are sent per second. A
+        // rate of zero means there is no limit.
+        double max_rate;
+        double permits;
+        std::chrono::steady_clock::time_point last_refill;
+
+        // Idle curl handles, along with their open connections
+        std::shared_ptr<HandlePool> handles;
+};
+
+#endif // TRANSPORT_H
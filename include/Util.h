@@ -1,8 +1,13 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <boost/optional.hpp>
+
 #include <string>
 
 bool confirm_yes(const std::string&, bool);
+std::string get_config_path(const std::string&);
+boost::optional<std::string> read_file(const std::string&);
+bool write_private_file(const std::string&, const std::string&);
 
 #endif // UTIL_H
@@ -0,0 +1,40 @@
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A pool of threads that run tasks until there are none left. Tasks may
+// enqueue more tasks while they run.
+class WorkQueue {
+    public:
+        typedef std::function<void()> task_t;
+
+        WorkQueue(const unsigned, const task_t = task_t());
+        ~WorkQueue();
+        bool enqueue(const task_t);
+        void start();
+        void wait();
+        void stop();
+        bool is_stopping();
+    private:
+        void run();
+
+        unsigned parallelism;
+
+        // Run by each thread before it starts on any task
+        task_t thread_init;
+
+        std::mutex mutex;
+        std::condition_variable work_available;
+        std::deque<task_t> tasks;
+        unsigned active_tasks;
+        bool stopping;
+        std::vector<std::thread> workers;
+};
+
+#endif // WORKQUEUE_H
@@ -0,0 +1,84 @@
+#include "Crawler.h"
+#include "FBGraph.h"
+#include "Transport.h"
+
+#include "json_spirit.h"
+
+Crawler::Crawler(FBGraph &graph, const unsigned parallelism,
+                 const unsigned max_depth, const unsigned budget) :
+    graph(graph), max_depth(max_depth), budget(budget),
+    // Requests from users of the mount go first, and are abandoned when the
+    // crawler stops
+    queue(parallelism, [this]() {
+        Transport::set_background_thread(true, [this]() { return queue.is_stopping(); });
+    }) {};
+
+Crawler::~Crawler() {
+    stop();
+}
+
+void Crawler::start() {
+    enqueue(0, [this]() { crawl_self(); });
+    queue.start();
+}
+
+void Crawler::stop() {
+    queue.stop();
+}
+
+// Each task makes roughly one request, so the budget is counted in tasks.
+// Tasks deeper than the maximum depth or over the budget are dropped.
+void Crawler::enqueue(const unsigned depth, const WorkQueue::task_t task) {
+    std::lock_guard<std::mutex> lock(budget_mutex);
+    if (depth > max_depth || budget == 0) {
+        return;
+    }
+
+    if (queue.enqueue(task)) {
+        --budget;
+    }
+}
+
+void Crawler::crawl_self() {
+    enqueue(0, [this]() { graph.get_user(); });
+    enqueue(0, [this]() {
+        std::vector<std::string> ids;
+        graph.list_statuses("me", ids);
+    });
+
+    // Album listings include everything that is shown about each album
+    enqueue(0, [this]() {
+        std::vector<std::string> names;
+        graph.list_albums("me", names);
+    });
+
+    // Loading the friend names also loads their IDs
+    enqueue(0, [this]() {
+        for (auto &name : graph.get_friends()) {
+            enqueue(1, [this, name]() { crawl_friend(name); });
+        }
+    });
+}
+
+void Crawler::crawl_friend(const std::string &name) {
+    std::string uid = graph.get_uid_from_name(name);
+
+    enqueue(1, [this, uid]() {
+        std::vector<std::string> ids;
+        graph.list_statuses(uid, ids);
+    });
+    enqueue(1, [this, uid]() {
+        std::vector<std::string> names;
+        graph.list_albums(uid, names);
+    });
+    enqueue(1, [this, uid]() {
+        // Friends are only listed for friends who have the app installed
+        json_spirit::mObject response = graph.get_installed(uid);
+        if (response.count("installed") && response.at("installed").get_bool()) {
+            enqueue(1, [this, uid]() {
+                std::vector<std::string> names;
+                graph.list_friends(uid, names);
+            });
+        }
+    });
+}
@@ -0,0 +1,371 @@
+#include "Exporter.h"
+#include "FBGraph.h"
+#include "FBQuery.h"
+#include "Transport.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+static const std::string PROGRESS_FILE_NAME = ".fbfs-dump";
+static const std::string DONE_CURSOR = "done";
+
+// Larger pages mean fewer requests against the rate limit
+static const std::string PAGE_SIZE = "100";
+
+// How often throughput is reported while exporting
+static const std::chrono::seconds REPORT_INTERVAL(5);
+
+static const std::string EXPORT_ERROR = "Could not export ";
+static const std::string PROGRESS_ERROR = "Could not record progress in ";
+static const std::string WRITE_ERROR = "Could not write ";
+static const std::string INCOMPLETE_EXPORT = " pages could not be exported. Run the same command again to retry them.";
+
+// Names may contain characters that aren't allowed in file names
+static std::string make_file_name(const std::string &name,
+                                  const std::string &fallback) {
+    std::string file_name(name);
+    for (char &c : file_name) {
+        if (c == '/' || c == '\0') {
+            c = '_';
+        }
+    }
+
+    if (file_name.empty() || file_name == "." || file_name == "..") {
+        return fallback;
+    }
+
+    return file_name;
+}
+
+static std::string decode_url_component(const std::string &component) {
+    std::string decoded;
+    for (std::size_t i = 0; i < component.length(); ++i) {
+        if (component[i] == '+') {
+            decoded += ' ';
+        } else if (component[i] == '%' && i + 2 < component.length()) {
+            decoded += static_cast<char>(
+                std::strtol(component.substr(i + 1, 2).c_str(), NULL, 16));
+            i += 2;
+        } else {
+            decoded += component[i];
+        }
+    }
+    return decoded;
+}
+
+// The cursor of a page is the query string of its URL, without the access
+// token. It is kept encoded so that it fits on one line of the progress file.
+static std::string get_cursor(const std::string &url) {
+    std::size_t query_start = url.find('?');
+    if (query_start == std::string::npos) {
+        return "";
+    }
+
+    std::string cursor;
+    std::istringstream parameters(url.substr(query_start + 1));
+    std::string parameter;
+    while (std::getline(parameters, parameter, '&')) {
+        if (parameter.empty() || parameter.compare(0, 13, "access_token=") == 0) {
+            continue;
+        }
+
+        cursor += (cursor.empty() ? "" : "&") + parameter;
+    }
+    return cursor;
+}
+
+// Builds the query for a page of a listing. The parameters in the cursor
+// replace the ones the listing was first requested with.
+static FBQuery make_page_query(const FBQuery &base, const std::string &cursor) {
+    parameters_t cursor_parameters;
+    std::istringstream parameters(cursor);
+    std::string parameter;
+    while (std::getline(parameters, parameter, '&')) {
+        std::size_t separator = parameter.find('=');
+        cursor_parameters.push_back(std::make_pair(
+            decode_url_component(parameter.substr(0, separator)),
+            separator == std::string::npos ?
+                "" : decode_url_component(parameter.substr(separator + 1))));
+    }
+
+    FBQuery query(base.get_node(), base.get_endpoint(), base.get_edge());
+    for (auto &base_parameter : base.get_parameters()) {
+        bool replaced = false;
+        for (auto &cursor_parameter : cursor_parameters) {
+            replaced = replaced || cursor_parameter.first == base_parameter.first;
+        }
+
+        if (!replaced) {
+            query.add_parameter(base_parameter.first, base_parameter.second);
+        }
+    }
+
+    for (auto &cursor_parameter : cursor_parameters) {
+        query.add_parameter(cursor_parameter.first, cursor_parameter.second);
+    }
+
+    return query;
+}
+
+Exporter::Exporter(FBGraph &graph, const std::string &root,
+                   const unsigned parallelism) :
+    graph(graph), root(root), queue(parallelism), progress_fd(-1),
+    requests(0), items(0), bytes(0), failures(0), done(false) {};
+
+int Exporter::run() {
+    boost::system::error_code error;
+    boost::filesystem::create_directories(root, error);
+    if (error) {
+        std::cerr << EXPORT_ERROR << root.string() << ": " << error.message()
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    load_progress();
+    std::string progress_path = (root / PROGRESS_FILE_NAME).string();
+    progress_fd = ::open(progress_path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (progress_fd == -1) {
+        std::cerr << PROGRESS_ERROR << progress_path << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    start_time = std::chrono::steady_clock::now();
+
+    add_listing("me", "statuses", root / "status");
+    add_listing("me", "albums", root / "albums");
+    queue.enqueue([this]() { export_friends(); });
+
+    std::thread reporter([this]() {
+        std::unique_lock<std::mutex> lock(report_mutex);
+        while (!finished.wait_for(lock, REPORT_INTERVAL, [this]() { return done; })) {
+            report();
+        }
+    });
+
+    queue.start();
+    queue.wait();
+
+    {
+        std::lock_guard<std::mutex> lock(report_mutex);
+        done = true;
+    }
+    finished.notify_all();
+    reporter.join();
+    report();
+
+    close(progress_fd);
+    progress_fd = -1;
+
+    if (failures > 0) {
+        std::cerr << failures << INCOMPLETE_EXPORT << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+void Exporter::load_progress() {
+    std::ifstream file((root / PROGRESS_FILE_NAME).string());
+    std::string line;
+    while (std::getline(file, line)) {
+        std::size_t separator = line.find(' ');
+        if (separator == std::string::npos) {
+            // A record that was cut short; its page is exported again
+            continue;
+        }
+
+        // Later records supersede earlier ones
+        progress[line.substr(0, separator)] = line.substr(separator + 1);
+    }
+}
+
+bool Exporter::record_progress(const std::string &key, const std::string &cursor) {
+    std::string record = key + " " + cursor + "\n";
+
+    std::lock_guard<std::mutex> lock(progress_mutex);
+    progress[key] = cursor;
+    return write(progress_fd, record.data(), record.length()) ==
+        static_cast<ssize_t>(record.length());
+}
+
+void Exporter::add_listing(const std::string &node, const std::string &edge,
+                           const boost::filesystem::path &directory) {
+    Listing listing = {node + "/" + edge, FBQuery(node, edge), directory,
+                       edge == "albums"};
+    listing.query.add_parameter("date_format", "U");
+    listing.query.add_parameter("limit", PAGE_SIZE);
+    if (listing.is_albums) {
+        listing.query.add_parameter("fields", "id,name,updated_time");
+    } else {
+        listing.query.add_parameter("fields", "updated_time,message,id");
+    }
+
+    std::string cursor;
+    {
+        std::lock_guard<std::mutex> lock(progress_mutex);
+        if (progress.count(listing.key)) {
+            cursor = progress.at(listing.key);
+        }
+    }
+
+    if (cursor == DONE_CURSOR) {
+        return;
+    }
+
+    queue.enqueue([this, listing, cursor]() { export_page(listing, cursor); });
+}
+
+void Exporter::export_friends() {
+    std::vector<std::string> names;
+    json_spirit::mObject response = graph.list_friends("me", names);
+    ++requests;
+    if (response.count("error")) {
+        ++failures;
+        std::cerr << EXPORT_ERROR << "friends: "
+                  << response.at("error").get_obj().at("message").get_str()
+                  << std::endl;
+        return;
+    }
+
+    for (auto &name : names) {
+        std::string uid;
+        try {
+            uid = graph.get_uid_from_name(name);
+        } catch (std::out_of_range &e) {
+            continue;
+        }
+
+        boost::filesystem::path directory =
+            root / "friends" / make_file_name(name, uid);
+        add_listing(uid, "statuses", directory / "status");
+        add_listing(uid, "albums", directory / "albums");
+    }
+}
+
+// Exports one page of a listing and queues the next one. Pages of different
+// listings are fetched in parallel, so there are always requests in flight
+// while pages are being written.
+void Exporter::export_page(const Listing listing, const std::string &cursor) {
+    json_spirit::mObject response = graph.fetch(make_page_query(listing.query, cursor));
+    ++requests;
+    if (response.count("error")) {
+        // The page isn't recorded, so it's fetched again on the next run
+        ++failures;
+        std::cerr << EXPORT_ERROR << listing.key << ": "
+                  << response.at("error").get_obj().at("message").get_str()
+                  << std::endl;
+        return;
+    }
+
+    boost::system::error_code error;
+    boost::filesystem::create_directories(listing.directory, error);
+
+    // A page is only recorded if all of it was written, since a run that
+    // continues from here would never write the rest
+    const json_spirit::mArray &data = response.at("data").get_array();
+    for (auto &item : data) {
+        bool written = listing.is_albums ?
+            write_album(listing.directory, item.get_obj()) :
+            write_status(listing.directory, item.get_obj());
+        if (!written) {
+            ++failures;
+            return;
+        }
+    }
+
+    // Facebook keeps returning a next page after the last one, but it's empty
+    std::string next_cursor = DONE_CURSOR;
+    if (!data.empty() && response.count("paging")) {
+        const json_spirit::mObject &paging = response.at("paging").get_obj();
+        if (paging.count("next")) {
+            next_cursor = get_cursor(paging.at("next").get_str());
+        }
+    }
+
+    // The position is only recorded once the page is on disk
+    if (!record_progress(listing.key, next_cursor)) {
+        std::cerr << PROGRESS_ERROR << (root / PROGRESS_FILE_NAME).string()
+                  << std::endl;
+    }
+
+    if (next_cursor != DONE_CURSOR) {
+        queue.enqueue([this, listing, next_cursor]() {
+            export_page(listing, next_cursor);
+        });
+    }
+}
+
+bool Exporter::write_status(const boost::filesystem::path &directory,
+                            const json_spirit::mObject &status) {
+    if (!status.count("message")) {
+        // The mount doesn't show statuses without a message either
+        return true;
+    }
+
+    const std::string &message = status.at("message").get_str();
+    boost::filesystem::path path = directory /
+        make_file_name(status.at("id").get_str(), "status");
+
+    // Errors such as a full disk may only show up when the file is closed
+    std::ofstream file(path.string(), std::ios::binary | std::ios::trunc);
+    file << message;
+    file.close();
+    if (!file.good()) {
+        std::cerr << WRITE_ERROR << path.string() << std::endl;
+        return false;
+    }
+
+    if (status.count("updated_time")) {
+        boost::system::error_code error;
+        boost::filesystem::last_write_time(path,
+            status.at("updated_time").get_int64(), error);
+    }
+
+    ++items;
+    bytes += message.length();
+    return true;
+}
+
+bool Exporter::write_album(const boost::filesystem::path &directory,
+                           const json_spirit::mObject &album) {
+    const std::string &id = album.at("id").get_str();
+    boost::filesystem::path path = directory / make_file_name(
+        album.count("name") ? album.at("name").get_str() : "", id);
+
+    boost::system::error_code error;
+    boost::filesystem::create_directories(path, error);
+    if (error) {
+        std::cerr << WRITE_ERROR << path.string() << ": " << error.message()
+                  << std::endl;
+        return false;
+    }
+
+    if (album.count("updated_time")) {
+        boost::filesystem::last_write_time(path,
+            album.at("updated_time").get_int64(), error);
+    }
+
+    ++items;
+    return true;
+}
+
+void Exporter::report() {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_time;
+    double seconds = std::max(elapsed.count(), 0.001);
+
+    std::cerr << std::fixed << std::setprecision(1)
+              << items << " items, " << requests << " requests in "
+              << seconds << "s (" << requests / seconds << " requests/s, "
+              << items / seconds << " items/s, "
+              << bytes / seconds / 1024 << " KiB/s)" << std::endl;
+}
@@ -1,12 +1,11 @@
 #include "FBGraph.h"
 #include "FBQuery.h"
 #include "Browser.h"
+#include "Trace.h"
 #include "Util.h"
 
 #include <boost/optional.hpp>
 #include <CurlEasy.h>
-#include <CurlHttpPost.h>
-#include <CurlPair.h>
 #include <fuse.h>
 
 #include <cstdlib>
@@ -22,13 +21,42 @@ static const std::string REDIRECT_URI = "https://www.facebook.com/connect/login_
 static const std::string RESPONSE_TYPE = "token";
 static const std::string FACEBOOK_GRAPH_URL = "https://graph.facebook.com";
 
+// Facebook's error code for an ID that doesn't exist
+static const int MISSING_OBJECT_CODE = 803;
+
+// Facebook's error codes for requests it may accept later: temporary outages
+// and rate limits, along with sessions and tokens that need renewing
+static const std::set<int> TRANSIENT_ERROR_CODES = {1, 2, 4, 17, 32, 341, 613};
+static const std::set<int> AUTH_ERROR_CODES = {102, 190};
+
+// Errors raised by fbfs itself rather than by Facebook
+const std::string TRANSPORT_ERROR_TYPE = "TransportException";
+
 // Strings
 static const std::string NOT_LOGGED_IN = "You appear to be logged out of Facebook.";
 static const std::string ASK_OPEN_BROWSER = "Would you like to open a browser and log in?";
 static const std::string CANCELLED_LOGIN = "Facebook has denied the request for your profile. Reason: ";
 static const std::string PROGRAM_TERMINATION = "The program will now terminate.";
-
-FBGraph::FBGraph() : logged_in(false), request_cache() {};
+static const std::string TOKEN_UNVERIFIED = "Could not reach Facebook to verify the saved access token.";
+static const std::string STALE_LISTING = "Could not refresh a listing, using the cached one: ";
+
+// Listings are checked for new objects this often, and fetched again in full
+// this often, unless configured otherwise
+static const std::chrono::seconds DEFAULT_LISTING_TTL(60);
+static const std::chrono::seconds DEFAULT_RECONCILE_INTERVAL(600);
+
+// Page size when asking for objects newer than a cached listing. A full page
+// means that there may be more, so the listing is replaced instead.
+static const std::size_t INCREMENTAL_PAGE_SIZE = 25;
+static const std::string INCREMENTAL_LIMIT = std::to_string(INCREMENTAL_PAGE_SIZE);
+
+FBGraph::FBGraph(std::shared_ptr<Transport> transport,
+                 std::shared_ptr<PublicCache> public_cache) :
+    logged_in(false), graph_url(FACEBOOK_GRAPH_URL), transport(transport),
+    public_cache(public_cache), request_cache(),
+    statuses(arena), friends(arena), albums(arena), search_index(arena),
+    listing_ttl(DEFAULT_LISTING_TTL),
+    reconcile_interval(DEFAULT_RECONCILE_INTERVAL), listing_generation(0) {};
 
 bool FBGraph::is_logged_in() const {
     return logged_in;
@@ -38,34 +66,658 @@ void FBGraph::set_logged_in(const bool is_logged_in) noexcept {
     this->logged_in = is_logged_in;
 }
 
-void FBGraph::set_access_token(const std::string &token) noexcept {
+void FBGraph::set_access_token(const std::string &token) {
     access_token = token;
+
+    // Cached responses, errors included, belong to the previous token
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    request_cache.clear();
+}
+
+std::string FBGraph::get_access_token() const {
+    return access_token;
+}
+
+void FBGraph::set_graph_url(const std::string &url) noexcept {
+    graph_url = url;
+}
+
+Transport& FBGraph::get_transport() noexcept {
+    return *transport;
+}
+
+void FBGraph::set_listing_ttl(const std::chrono::seconds ttl) noexcept {
+    listing_ttl = ttl;
+}
+
+void FBGraph::set_reconcile_interval(const std::chrono::seconds interval) noexcept {
+    reconcile_interval = interval;
+}
+
+void FBGraph::set_interrupt_check(const std::function<bool()> check) {
+    transport->set_interrupt_check(check);
+}
+
+// Builds a response in the same format as a Graph API error, so that callers
+// can handle transport failures like any other error.
+static std::string make_transport_error(const std::string &message,
+                                       const transport_error_code code) {
+    json_spirit::mObject error;
+    error["message"] = message;
+    error["type"] = TRANSPORT_ERROR_TYPE;
+    error["code"] = static_cast<int>(code);
+
+    json_spirit::mObject response;
+    response["error"] = error;
+    return json_spirit::write(response);
+}
+
+// The error Facebook gives for objects that don't exist
+static json_spirit::mObject make_missing_error(const std::string &id) {
+    json_spirit::mObject error;
+    error["message"] = "Object does not exist: " + id;
+    error["type"] = "OAuthException";
+    error["code"] = MISSING_OBJECT_CODE;
+
+    json_spirit::mObject response;
+    response["error"] = error;
+    return response;
+}
+
+bool FBGraph::is_transport_error(const json_spirit::mObject &response) {
+    return response.count("error") &&
+        response.at("error").get_obj().at("type").get_str() == TRANSPORT_ERROR_TYPE;
+}
+
+// Whether sending the same request again may succeed, as opposed to Facebook
+// having refused it for good
+bool FBGraph::is_retryable_error(const json_spirit::mObject &response) {
+    if (!response.count("error")) {
+        return false;
+    } else if (is_transport_error(response)) {
+        return true;
+    }
+
+    const json_spirit::mObject &error = response.at("error").get_obj();
+    if (error.count("is_transient") &&
+            error.at("is_transient").type() == json_spirit::bool_type &&
+            error.at("is_transient").get_bool()) {
+        return true;
+    }
+
+    if (!error.count("code") || error.at("code").type() != json_spirit::int_type) {
+        return false;
+    }
+
+    int code = error.at("code").get_int();
+    return TRANSIENT_ERROR_CODES.count(code) || AUTH_ERROR_CODES.count(code);
+}
+
+static std::tuple<std::string, std::string, std::string, parameters_t>
+make_request_key(const FBQuery &query) {
+    return std::make_tuple(query.get_node(), query.get_endpoint(),
+                           query.get_edge(), query.get_parameters());
+}
+
+bool FBGraph::validate_access_token() {
+    FBQuery query("me");
+    query.add_parameter("fields", "id");
+
+    // An invalid token must not leave its error in the cache, where
+    // get_user() would find it after logging in again
+    json_spirit::mObject response = fetch(query);
+
+    if (is_transport_error(response)) {
+        // Facebook couldn't be reached, so the token can't be checked. Assume
+        // it's still good rather than asking the user to log in again.
+        std::cerr << TOKEN_UNVERIFIED << std::endl;
+    } else if (response.count("error")) {
+        return false;
+    } else {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        request_cache[make_request_key(query)] = response;
+    }
+
+    set_logged_in(true);
+    return true;
+}
+
+static FBQuery make_status_query(const std::string &id) {
+    FBQuery query(id);
+    query.add_parameter("date_format", "U");
+    query.add_parameter("fields", "message,updated_time");
+    return query;
+}
+
+static FBQuery make_fql_query(const std::string &fql_query) {
+    FBQuery query("fql");
+    query.add_parameter("q", fql_query);
+    return query;
 }
 
-static std::size_t write_callback(void *contents, std::size_t size,
-                                  std::size_t nmemb, void *userdata) {
-    (void)userdata;
-    std::size_t real_size = size * nmemb;
-    static_cast<std::string*>(userdata)->append(static_cast<char*>(contents), real_size);
-    return real_size;
+// IDs are strings in the Graph API but may be numbers in FQL results
+static std::string get_id_string(const json_spirit::mValue &id) {
+    if (id.type() == json_spirit::str_type) {
+        return id.get_str();
+    }
+
+    return std::to_string(id.get_int64());
 }
 
 json_spirit::mObject FBGraph::get(const FBQuery &query,
                                   const bool should_clear_cache) {
+    // Cache the request
+    auto request = make_request_key(query);
+    if (!should_clear_cache) {
+        TraceSpan span("request_cache", "cache");
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (request_cache.count(request)) {
+            return request_cache.at(request);
+        }
+    }
 
-    std::string node = query.get_node();
-    std::string endpoint = query.get_endpoint();
-    std::string edge = query.get_edge();
-    auto parameters = query.get_parameters();
+    // The cache isn't locked while waiting on Facebook, so that other
+    // threads can still be served from it
+    json_spirit::mObject response = fetch(query);
+    if (is_transport_error(response)) {
+        // Don't cache transient failures
+        return response;
+    }
 
-    // Cache the request
-    auto request = std::make_tuple(node, endpoint, edge, parameters);
-    if (should_clear_cache || !request_cache.count(request)) {
-        std::string response = send_request("GET", query);
-        request_cache[request] = parse_response(response).get_obj();
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    request_cache[request] = response;
+    return response;
+}
+
+// Like get(), but for responses that are the same for every account. Errors
+// aren't shared, since they may come from this account's permissions.
+json_spirit::mObject FBGraph::get_public(const FBQuery &query) {
+    boost::optional<json_spirit::mObject> cached = public_cache->find(query);
+    if (cached) {
+        return cached.get();
+    }
+
+    json_spirit::mObject response = fetch(query);
+    if (!response.count("error")) {
+        public_cache->put(query, response);
+    }
+
+    return response;
+}
+
+// Sends a GET request without looking in or adding to the cache
+json_spirit::mObject FBGraph::fetch(const FBQuery &query) {
+    return parse_response(send_request("GET", query)).get_obj();
+}
+
+json_spirit::mObject FBGraph::load_status(const std::string &id,
+                                          const bool should_clear_cache) {
+    // Failed lookups stay in the request cache, but statuses that exist are
+    // moved into the status table
+    FBQuery query = make_status_query(id);
+    json_spirit::mObject response = get(query, should_clear_cache);
+    if (response.count("error")) {
+        return response;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    request_cache.erase(make_request_key(query));
+    put_status(id,
+               response.count("updated_time") ? response.at("updated_time").get_int64() : 0,
+               response.count("message") ? response.at("message").get_str() : "");
+    return json_spirit::mObject();
+}
+
+// Adds or updates a status, and indexes its message if it changed. The cache
+// must be locked.
+Table::row_t FBGraph::put_status(const std::string &id, const int64_t updated_time,
+                                 const std::string &message) {
+    boost::optional<Table::row_t> existing = statuses.find(id);
+    boost::optional<uint32_t> version;
+    if (existing) {
+        version = statuses.get_version(existing.get());
+    }
+
+    Table::row_t row = statuses.put(id, updated_time, message);
+    if (!version || statuses.get_version(row) != version.get()) {
+        search_index.add(row, message);
+    }
+
+    return row;
+}
+
+json_spirit::mObject FBGraph::list_statuses(const std::string &node,
+                                            std::vector<std::string> &ids,
+                                            const bool should_clear_cache) {
+    json_spirit::mObject response = sync_statuses(node, should_clear_cache);
+    if (response.count("error")) {
+        return response;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    for (Table::row_t row : statuses.get_listing(node)) {
+        ids.push_back(statuses.get_key(row));
+    }
+
+    return json_spirit::mObject();
+}
+
+// Brings the cached listing of a node's statuses up to date, if it is due
+json_spirit::mObject FBGraph::sync_statuses(const std::string &node,
+                                            const bool should_clear_cache) {
+    sync_mode mode;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        mode = should_clear_cache ?
+            SYNC_FULL : get_sync_mode(status_syncs, statuses, node);
+    }
+
+    if (mode == SYNC_NONE) {
+        return json_spirit::mObject();
+    }
+
+    json_spirit::mObject response = load_statuses(node, mode == SYNC_INCREMENTAL);
+    if (response.count("error") && !should_clear_cache &&
+            has_listing(statuses, node)) {
+        // An out of date listing is better than none
+        std::cerr << STALE_LISTING << response.at("error").get_obj().at("message").get_str()
+                  << std::endl;
+        return json_spirit::mObject();
+    }
+
+    return response;
+}
+
+// Fetches the statuses of a node. An incremental load only asks for the
+// statuses updated since the newest one in the cached listing, and adds them
+// to it; a full load replaces the listing, which is the only way to notice
+// statuses that were deleted.
+json_spirit::mObject FBGraph::load_statuses(const std::string &node,
+                                            const bool incremental) {
+    FBQuery query(node, "statuses");
+    query.add_parameter("date_format", "U");
+    query.add_parameter("fields", "updated_time,message,id");
+
+    int64_t since = 0;
+    if (incremental) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        since = get_since(status_syncs, node);
+        query.add_parameter("since", std::to_string(since));
+        query.add_parameter("limit", INCREMENTAL_LIMIT);
+    }
+
+    json_spirit::mObject response = fetch(query);
+    if (response.count("error")) {
+        return response;
+    }
+
+    // The listing contains everything that is known about each status,
+    // so there's no need to ask for them again one by one
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    const json_spirit::mArray &data = response.at("data").get_array();
+    std::vector<Table::row_t> rows;
+    int64_t newest_time = since;
+    for (auto &status_value : data) {
+        const json_spirit::mObject &status = status_value.get_obj();
+        int64_t updated_time = status.count("updated_time") ?
+            status.at("updated_time").get_int64() : 0;
+        newest_time = std::max(newest_time, updated_time);
+        if (!status.count("message")) {
+            // The status doesn't have a message
+            continue;
+        }
+
+        rows.push_back(put_status(status.at("id").get_str(), updated_time,
+                                  status.at("message").get_str()));
+    }
+
+    // If a whole page is newer, there may be even more that didn't fit, so
+    // the page replaces the listing instead
+    bool replace = !incremental || data.size() >= INCREMENTAL_PAGE_SIZE;
+    merge_listing(statuses, node, rows, replace);
+    record_sync(status_syncs, node, newest_time, replace);
+    return json_spirit::mObject();
+}
+
+json_spirit::mObject FBGraph::stat_status(const std::string &id,
+                                          time_t &updated_time,
+                                          std::size_t &size,
+                                          const bool should_clear_cache) {
+    boost::optional<Table::row_t> row = find_row(statuses, id);
+    if (should_clear_cache || !row) {
+        json_spirit::mObject response = load_status(id, should_clear_cache);
+        if (response.count("error")) {
+            return response;
+        }
+    }
+
+    // The status may have been removed while it was being loaded
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    row = statuses.find(id);
+    if (!row) {
+        return make_missing_error(id);
+    }
+
+    updated_time = statuses.get_updated_time(row.get());
+    size = statuses.get_message_length(row.get());
+    return json_spirit::mObject();
+}
+
+json_spirit::mObject FBGraph::read_status(const std::string &id, char *buffer,
+                                          std::size_t size, std::size_t offset,
+                                          std::size_t &count,
+                                          const bool should_clear_cache) {
+    boost::optional<Table::row_t> row = find_row(statuses, id);
+    if (should_clear_cache || !row) {
+        json_spirit::mObject response = load_status(id, should_clear_cache);
+        if (response.count("error")) {
+            return response;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    row = statuses.find(id);
+    if (!row) {
+        return make_missing_error(id);
+    }
+
+    count = statuses.read_message(row.get(), buffer, size, offset);
+    return json_spirit::mObject();
+}
+
+// Returns a value that changes whenever the message of the status does, if the
+// status is known
+boost::optional<uint32_t> FBGraph::get_status_version(const std::string &id) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    boost::optional<Table::row_t> row = statuses.find(id);
+    if (!row) {
+        return boost::optional<uint32_t>();
+    }
+
+    return boost::optional<uint32_t>(statuses.get_version(row.get()));
+}
+
+// Brings the cached listing of a node's albums up to date, if it is due
+json_spirit::mObject FBGraph::sync_albums(const std::string &node) {
+    sync_mode mode;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        mode = get_sync_mode(album_syncs, albums, node);
+    }
+
+    if (mode == SYNC_NONE) {
+        return json_spirit::mObject();
+    }
+
+    json_spirit::mObject response = load_albums(node, mode == SYNC_INCREMENTAL);
+    if (response.count("error") && has_listing(albums, node)) {
+        std::cerr << STALE_LISTING << response.at("error").get_obj().at("message").get_str()
+                  << std::endl;
+        return json_spirit::mObject();
+    }
+
+    return response;
+}
+
+json_spirit::mObject FBGraph::load_albums(const std::string &node,
+                                          const bool incremental) {
+    FBQuery query(node, "albums");
+    query.add_parameter("date_format", "U");
+    query.add_parameter("fields", "id,name,updated_time");
+
+    int64_t since = 0;
+    if (incremental) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        since = get_since(album_syncs, node);
+        query.add_parameter("since", std::to_string(since));
+        query.add_parameter("limit", INCREMENTAL_LIMIT);
+    }
+
+    json_spirit::mObject response = fetch(query);
+    if (response.count("error")) {
+        return response;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    const json_spirit::mArray &data = response.at("data").get_array();
+    std::vector<Table::row_t> rows;
+    int64_t newest_time = since;
+    for (auto &album_value : data) {
+        const json_spirit::mObject &album = album_value.get_obj();
+        int64_t updated_time = album.count("updated_time") ?
+            album.at("updated_time").get_int64() : 0;
+        newest_time = std::max(newest_time, updated_time);
+        rows.push_back(albums.put(album.at("id").get_str(),
+            album.at("name").get_str(), updated_time));
+    }
+
+    bool replace = !incremental || data.size() >= INCREMENTAL_PAGE_SIZE;
+    merge_listing(albums, node, rows, replace);
+    record_sync(album_syncs, node, newest_time, replace);
+    return json_spirit::mObject();
+}
+
+// Decides whether a cached listing is still fresh. The cache must be locked.
+FBGraph::sync_mode FBGraph::get_sync_mode(
+        const std::map<std::string, ListingSync> &syncs, const Table &table,
+        const std::string &node) const {
+    auto sync = syncs.find(node);
+    if (!table.has_listing(node) || sync == syncs.end()) {
+        return SYNC_FULL;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (reconcile_interval != std::chrono::seconds::zero() &&
+            now - sync->second.reconciled >= reconcile_interval) {
+        return SYNC_FULL;
+    }
+
+    if (listing_ttl != std::chrono::seconds::zero() &&
+            now - sync->second.synced >= listing_ttl) {
+        return SYNC_INCREMENTAL;
+    }
+
+    return SYNC_NONE;
+}
+
+// The cache must be locked
+int64_t FBGraph::get_since(const std::map<std::string, ListingSync> &syncs,
+                           const std::string &node) const {
+    auto sync = syncs.find(node);
+    return sync == syncs.end() ? 0 : sync->second.newest_time;
+}
+
+// The cache must be locked
+void FBGraph::record_sync(std::map<std::string, ListingSync> &syncs,
+                          const std::string &node, const int64_t newest_time,
+                          const bool reconciled) {
+    auto now = std::chrono::steady_clock::now();
+    ListingSync &sync = syncs[node];
+    sync.newest_time = newest_time;
+    sync.synced = now;
+    if (reconciled) {
+        sync.reconciled = now;
+    }
+}
+
+// Facebook lists the newest objects first, so objects that weren't in the
+// listing yet go in front, in the same order. The cache must be locked.
+void FBGraph::merge_listing(Table &table, const std::string &node,
+                            const std::vector<Table::row_t> &rows,
+                            const bool replace) {
+    ++listing_generation;
+    if (replace || !table.has_listing(node)) {
+        table.set_listing(node, rows);
+        return;
+    }
+
+    for (auto row = rows.rbegin(); row != rows.rend(); ++row) {
+        table.prepend_to_listing(node, *row);
+    }
+}
+
+// A number that changes whenever objects may have been added to a listing, so
+// that callers who remember missing paths know when to forget them
+uint64_t FBGraph::get_listing_generation() const {
+    return listing_generation;
+}
+
+json_spirit::mObject FBGraph::list_albums(const std::string &node,
+                                          std::vector<std::string> &names) {
+    json_spirit::mObject response = sync_albums(node);
+    if (response.count("error")) {
+        return response;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    for (Table::row_t row : albums.get_listing(node)) {
+        names.push_back(albums.get_name(row));
+    }
+
+    return json_spirit::mObject();
+}
+
+json_spirit::mObject FBGraph::stat_album(const std::string &node,
+                                         const std::string &name,
+                                         time_t &updated_time) {
+    json_spirit::mObject response = sync_albums(node);
+    if (response.count("error")) {
+        return response;
     }
 
-    return request_cache.at(request);
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    boost::optional<Table::row_t> row = albums.find_by_name(node, name);
+    updated_time = row ? albums.get_updated_time(row.get()) : 0;
+    return json_spirit::mObject();
+}
+
+// Starts uploading a photo into one of a node's albums. The photo is sent to
+// Facebook while it is being written to the upload. If there is no such
+// album, the upload is left empty.
+json_spirit::mObject FBGraph::start_photo_upload(const std::string &node,
+                                                 const std::string &album_name,
+                                                 const std::string &filename,
+                                                 std::unique_ptr<Upload> &upload) {
+    json_spirit::mObject response = sync_albums(node);
+    if (response.count("error")) {
+        return response;
+    }
+
+    std::string album_id;
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        boost::optional<Table::row_t> row = albums.find_by_name(node, album_name);
+        if (!row) {
+            return json_spirit::mObject();
+        }
+        album_id = albums.get_key(row.get());
+    }
+
+    FBQuery query(album_id, "photos");
+    Response failure;
+    upload = transport->start_upload(make_url(query), "source", filename, failure);
+    if (!upload) {
+        return parse_response(get_body(failure)).get_obj();
+    }
+
+    return json_spirit::mObject();
+}
+
+// Waits for Facebook to accept an uploaded photo. On success, the response
+// contains the ID of the new photo.
+json_spirit::mObject FBGraph::finish_photo_upload(Upload &upload) {
+    Response response = upload.finish();
+    return parse_response(get_body(response)).get_obj();
+}
+
+json_spirit::mObject FBGraph::list_friends(const std::string &node,
+                                           std::vector<std::string> &names) {
+    if (node == "me") {
+        json_spirit::mObject response = load_own_friends();
+        if (response.count("error")) {
+            return response;
+        }
+    } else if (!has_listing(friends, node)) {
+        // Get friends of a friend (we can only retrieve users who use the app)
+        std::string friends_of_friend_query = (
+            "SELECT uid, name FROM user "
+                 "WHERE uid IN (SELECT uid2 FROM friend "
+                 "WHERE uid1 IN (SELECT uid FROM user "
+                 "WHERE uid IN (SELECT uid2 FROM friend "
+                 "WHERE uid1 = " + node + ") and is_app_user=1))");
+        json_spirit::mObject response = fetch(make_fql_query(friends_of_friend_query));
+        if (response.count("error")) {
+            return response;
+        }
+
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        std::vector<Table::row_t> rows;
+        for (auto &friend_value : response.at("data").get_array()) {
+            const json_spirit::mObject &friend_obj = friend_value.get_obj();
+            rows.push_back(friends.put(get_id_string(friend_obj.at("uid")),
+                                       friend_obj.at("name").get_str()));
+        }
+        friends.set_listing(node, rows);
+        ++listing_generation;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    for (Table::row_t row : friends.get_listing(node)) {
+        names.push_back(friends.get_name(row));
+    }
+
+    return json_spirit::mObject();
+}
+
+json_spirit::mObject FBGraph::load_own_friends() {
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (friends.has_own_friends()) {
+            return json_spirit::mObject();
+        }
+    }
+
+    // The IDs come along with the names, which saves a query per friend when
+    // looking them up by name later
+    std::string fql = "SELECT id, name FROM profile WHERE id IN "
+                      "(SELECT uid2 FROM friend WHERE uid1 = me())";
+    json_spirit::mObject response = fetch(make_fql_query(fql));
+    if (response.count("error")) {
+        return response;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    std::vector<Table::row_t> rows;
+    for (auto &friend_value : response.at("data").get_array()) {
+        const json_spirit::mObject &friend_obj = friend_value.get_obj();
+        rows.push_back(friends.put(get_id_string(friend_obj.at("id")),
+                                   friend_obj.at("name").get_str()));
+    }
+    friends.set_own_friends(rows);
+    ++listing_generation;
+
+    return json_spirit::mObject();
+}
+
+bool FBGraph::has_listing(const Table &table, const std::string &node) {
+    TraceSpan span("has_listing", "cache");
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return table.has_listing(node);
+}
+
+boost::optional<Table::row_t> FBGraph::find_row(const Table &table,
+                                                const std::string &key) {
+    TraceSpan span("find_row", "cache");
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return table.find(key);
+}
+
+json_spirit::mObject FBGraph::get_installed(const std::string &node) {
+    FBQuery query(node);
+    query.add_parameter("fields", "installed");
+
+    // Whether someone uses the app is the same for every account
+    return get_public(query);
 }
 
 json_spirit::mObject FBGraph::post(const FBQuery &query) {
@@ -77,12 +729,18 @@ json_spirit::mValue FBGraph::del(const FBQuery &query) {
 }
 
 std::string FBGraph::send_request(const std::string &type, const FBQuery &query) {
+    // The URL contains the access token, so only the node is recorded
+    TraceSpan span("send_request", "transport", query.get_node().c_str());
+    Response response = transport->perform(type, make_url(query));
+    return get_body(response);
+}
+
+std::string FBGraph::make_url(const FBQuery &query) const {
     curl::CurlEasy request;
-    std::string response;
 
     // Construct the request URL
     std::ostringstream url_stream;
-    url_stream << FACEBOOK_GRAPH_URL << "/" << query.get_node();
+    url_stream << graph_url << "/" << query.get_node();
     if (!query.get_endpoint().empty()) {
         url_stream << "/" << query.get_endpoint();
     }
@@ -103,28 +761,35 @@ std::string FBGraph::send_request(const std::string &type, const FBQuery &query)
         }
     }
 
-    std::string url = url_stream.str();
-
-    std::cout << url << std::endl;
+    return url_stream.str();
+}
 
-    if (type == "POST") {
-        CurlHttpPost post;
-        request.addOption(CurlPair<CURLoption,CurlHttpPost>(CURLOPT_HTTPPOST, post));
-    } else if (type == "DELETE") {
-        request.addOption(CurlPair<CURLoption,std::string>(CURLOPT_CUSTOMREQUEST, "DELETE"));
+// Turns a response into JSON, whether it's the one Facebook sent or an error
+// describing why there isn't one
+std::string FBGraph::get_body(const Response &response) {
+    if (response.interrupted) {
+        return make_transport_error(response.error, TRANSPORT_INTERRUPTED);
+    } else if (response.timed_out) {
+        return make_transport_error(response.error, TRANSPORT_TIMED_OUT);
+    } else if (!response.error.empty()) {
+        return make_transport_error(response.error, TRANSPORT_FAILED);
     }
 
-    request.addOption(CurlPair<CURLoption,string>(CURLOPT_URL, url));
-    request.addOption(CurlPair<CURLoption,decltype(&write_callback)>(CURLOPT_WRITEFUNCTION, &write_callback));
-    request.addOption(CurlPair<CURLoption,std::string*>(CURLOPT_WRITEDATA, &response));
-    request.perform();
-
-    std::cout << response << std::endl;
+    // Facebook reports its own errors as JSON objects. Anything else (such as
+    // an error page from a proxy) is turned into one, as is any server error:
+    // Facebook failed rather than refused, whatever the body says.
+    if (response.body.empty() || response.status >= 500 ||
+            (response.status >= 400 && response.body[0] != '{')) {
+        return make_transport_error("Unexpected response with HTTP status " +
+                                    std::to_string(response.status),
+                                    TRANSPORT_FAILED);
+    }
 
-    return response;
+    return response.body;
 }
 
 json_spirit::mValue FBGraph::parse_response(const std::string &response) {
+    TraceSpan span("parse_response", "parse");
     json_spirit::mValue response_json;
     json_spirit::read(response, response_json);
 
@@ -192,38 +857,114 @@ std::string FBGraph::get_endpoint_for_permission(const std::string &permission)
 }
 
 std::string FBGraph::get_uid_from_name(std::string name) {
-    std::string fql = "SELECT id FROM profile WHERE id IN "
-                      "(SELECT uid2 FROM friend WHERE uid1 = me()) "
-                      "AND name = \"" + name + "\"";
-    json_spirit::mObject response = fql_get(fql);
+    load_own_friends();
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    boost::optional<Table::row_t> row = friends.find_own_friend(name);
+    if (!row) {
+        throw std::out_of_range("Not a friend: " + name);
+    }
 
     // FIXME: Code assumes unique names for now
-    return response.at("data").get_array()[0].get_obj().at("id").get_str();
+    return friends.get_key(row.get());
+}
+
+bool FBGraph::is_friend(const std::string &name) {
+    load_own_friends();
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    return friends.find_own_friend(name).is_initialized();
 }
 
 std::set<std::string> FBGraph::get_friends() {
-    std::string fql = "SELECT name FROM profile WHERE id IN "
-                      "(SELECT uid2 FROM friend WHERE uid1 = me())";
-    json_spirit::mObject response = fql_get(fql);
-    json_spirit::mArray friends_list = response.at("data").get_array();
-    std::set<std::string> friends;
-    for (auto &friend_name : friends_list) {
-        friends.insert(friend_name.get_obj().at("name").get_str());
+    load_own_friends();
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    std::set<std::string> names;
+    for (Table::row_t row : friends.get_listing("me")) {
+        names.insert(friends.get_name(row));
     }
 
-    return friends;
+    return names;
 }
 
+// Adds a status that was just posted to the cached listing, instead of
+// fetching the whole listing again to find it
+void FBGraph::add_posted_status(const std::string &post_id,
+                                const std::string &message) {
+    // Posts to the feed are identified by the user ID and the status ID,
+    // but statuses are listed by status ID alone
+    std::string id = post_id.substr(post_id.find('_') + 1);
+    std::string user = get_user();
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    Table::row_t row = put_status(id, std::time(NULL), message);
+    statuses.prepend_to_listing("me", row);
+    ++listing_generation;
+
+    // The same listing may also be cached under the user's ID
+    statuses.remove_listing(user);
+}
+
+// Finds the statuses that have been fetched so far and contain every word of
+// the query. This never goes to the network.
+std::vector<std::string> FBGraph::search_statuses(const std::string &query) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    std::vector<std::string> ids;
+    for (Table::row_t row : search_index.search(query)) {
+        // The index may still list statuses that were deleted, or whose
+        // message no longer contains the words
+        std::string id = statuses.get_key(row);
+        boost::optional<Table::row_t> current = statuses.find(id);
+        if (current && current.get() == row &&
+                SearchIndex::matches(statuses.get_message(row), query)) {
+            ids.push_back(id);
+        }
+    }
+
+    return ids;
+}
+
+void FBGraph::remove_status(const std::string &id) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    statuses.remove(id);
+    request_cache.erase(make_request_key(make_status_query(id)));
+}
+
+// Forgets every cached response about a node, so that it is fetched again the
+// next time it is needed
+void FBGraph::invalidate(const std::string &node) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto begin = request_cache.lower_bound(
+        std::make_tuple(node, std::string(), std::string(), parameters_t()));
+    auto end = begin;
+    while (end != request_cache.end() && std::get<0>(end->first) == node) {
+        ++end;
+    }
+    request_cache.erase(begin, end);
+
+    statuses.remove_listing(node);
+    albums.remove_listing(node);
+    if (node != "me") {
+        friends.remove_listing(node);
+    }
+}
 
 json_spirit::mObject FBGraph::fql_get(const std::string &fql_query,
                                       bool should_clear_cache) {
-    if (!should_clear_cache && fql_cache.count(fql_query)) {
-        return fql_cache.at(fql_query);
+    if (!should_clear_cache) {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        if (fql_cache.count(fql_query)) {
+            return fql_cache.at(fql_query);
+        }
     }
 
-    FBQuery query("fql");
-    query.add_parameter("q", fql_query);
-    json_spirit::mObject response = parse_response(send_request("GET", query)).get_obj();
+    json_spirit::mObject response = fetch(make_fql_query(fql_query));
+    if (is_transport_error(response)) {
+        return response;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
     fql_cache[fql_query] = response;
     return response;
 }
@@ -231,7 +972,17 @@ json_spirit::mObject FBGraph::fql_get(const std::string &fql_query,
 std::string FBGraph::get_user() {
     FBQuery query("me");
     query.add_parameter("fields", "id");
-    return get(query).at("id").get_str();
+    json_spirit::mObject response = get(query);
+    if (response.count("error")) {
+        // The error may only be due to the current token, so don't keep it
+        {
+            std::lock_guard<std::mutex> lock(cache_mutex);
+            request_cache.erase(make_request_key(query));
+        }
+        throw std::runtime_error(response.at("error").get_obj().at("message").get_str());
+    }
+
+    return response.at("id").get_str();
 }
 
 void FBGraph::login(std::vector<std::string> &permissions,
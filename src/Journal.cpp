@@ -0,0 +1,418 @@
+#include "Journal.h"
+#include "FBGraph.h"
+#include "FBQuery.h"
+#include "Util.h"
+
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+static const std::string POST_OPERATION = "post";
+static const std::string DELETE_OPERATION = "delete";
+static const std::string DONE_OPERATION = "done";
+static const std::string PENDING_PREFIX = "pending-";
+
+// How long to wait before trying again when Facebook can't be reached
+static const std::chrono::seconds RETRY_MIN(1);
+static const std::chrono::seconds RETRY_MAX(60);
+
+// How far before a post was journaled to look for it on Facebook, in case the
+// clocks disagree
+static const time_t CLOCK_SLACK = 600;
+
+std::string JournalEntry::get_pending_name() const {
+    return PENDING_PREFIX + std::to_string(sequence);
+}
+
+// Messages may contain newlines, which would end the record early
+static std::string escape(const std::string &value) {
+    std::string escaped;
+    for (char c : value) {
+        if (c == '\\') {
+            escaped += "\\\\";
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static std::string unescape(const std::string &value) {
+    std::string unescaped;
+    for (std::size_t i = 0; i < value.length(); ++i) {
+        if (value[i] == '\\' && i + 1 < value.length()) {
+            ++i;
+            unescaped += value[i] == 'n' ? '\n' : value[i];
+        } else {
+            unescaped += value[i];
+        }
+    }
+    return unescaped;
+}
+
+static std::string format_entry(const JournalEntry &entry) {
+    std::ostringstream record;
+    record << entry.operation << " " << entry.sequence << " " << entry.time
+           << " " << escape(entry.argument) << "\n";
+    return record.str();
+}
+
+Journal::Journal(FBGraph &graph, const std::string &path) :
+    graph(graph), path(path), fd(-1), next_sequence(1), in_flight(0),
+    stopping(false) {};
+
+Journal::~Journal() {
+    stop();
+}
+
+bool Journal::open() {
+    if (!replay()) {
+        return false;
+    }
+
+    fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd == -1) {
+        return false;
+    }
+
+    worker = std::thread(&Journal::run, this);
+    return true;
+}
+
+void Journal::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+
+    // Whatever is left stays in the journal for the next mount
+    if (worker.joinable()) {
+        worker.join();
+    }
+
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+// Loads the entries that weren't applied yet, and rewrites the journal so that
+// it only contains those.
+bool Journal::replay() {
+    std::map<unsigned long, JournalEntry> entries;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        // Each record is written along with its newline, so one without it
+        // was cut short by a crash, or padded with zeros after a power loss.
+        // It was never acknowledged, and nothing follows it.
+        if (file.eof() || line.find('\0') != std::string::npos) {
+            break;
+        }
+
+        std::istringstream record(line);
+        JournalEntry entry;
+        record >> entry.operation >> entry.sequence;
+        if (!record) {
+            continue;
+        }
+
+        next_sequence = std::max(next_sequence, entry.sequence + 1);
+        if (entry.operation == DONE_OPERATION) {
+            entries.erase(entry.sequence);
+            continue;
+        }
+
+        record >> entry.time;
+        if (!record) {
+            continue;
+        }
+        record.get();
+        std::getline(record, entry.argument);
+        entry.argument = unescape(entry.argument);
+        entries[entry.sequence] = entry;
+    }
+
+    std::string contents;
+    for (auto &entry : entries) {
+        // fbfs may have died after sending it
+        if (entry.second.operation == POST_OPERATION) {
+            maybe_sent.insert(entry.first);
+        }
+        pending.push_back(entry.second);
+        contents += format_entry(entry.second);
+    }
+
+    if (!pending.empty()) {
+        std::cout << "Replaying " << pending.size()
+                  << " unfinished posts and deletions" << std::endl;
+    }
+
+    return write_private_file(path, contents);
+}
+
+bool Journal::append(const JournalEntry &entry) {
+    return append_record(format_entry(entry));
+}
+
+bool Journal::append_done(const unsigned long sequence) {
+    return append_record(DONE_OPERATION + " " + std::to_string(sequence) + "\n");
+}
+
+// Writes a record and waits for it to reach the disk. If that fails, the
+// journal is cut back to where it was, so that the next record doesn't follow
+// a torn one. The journal must be locked.
+bool Journal::append_record(const std::string &record) {
+    off_t length = lseek(fd, 0, SEEK_END);
+    if (length == -1) {
+        return false;
+    }
+
+    if (write(fd, record.data(), record.size()) ==
+            static_cast<ssize_t>(record.size()) &&
+            fdatasync(fd) == 0) {
+        return true;
+    }
+
+    if (ftruncate(fd, length) != 0) {
+        std::cerr << "Could not undo a partial write to the journal at "
+                  << path << std::endl;
+    }
+    return false;
+}
+
+bool Journal::post(const std::string &message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    JournalEntry entry;
+    entry.sequence = next_sequence++;
+    entry.operation = POST_OPERATION;
+    entry.time = std::time(NULL);
+    entry.argument = message;
+    if (!append(entry)) {
+        return false;
+    }
+
+    pending.push_back(entry);
+    work_available.notify_all();
+    return true;
+}
+
+bool Journal::remove(const std::string &id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    JournalEntry entry;
+    entry.sequence = next_sequence++;
+    entry.operation = DELETE_OPERATION;
+    entry.time = std::time(NULL);
+    entry.argument = id;
+    if (!append(entry)) {
+        return false;
+    }
+
+    pending.push_back(entry);
+    work_available.notify_all();
+    return true;
+}
+
+// Withdraws a pending post, unless it's already being sent or may have been
+bool Journal::cancel(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto entry = pending.begin(); entry != pending.end(); ++entry) {
+        if (entry->operation == POST_OPERATION &&
+                entry->get_pending_name() == name) {
+            // A post that may have been sent can't be taken back here
+            if (entry->sequence == in_flight || maybe_sent.count(entry->sequence) ||
+                    !append_done(entry->sequence)) {
+                return false;
+            }
+
+            pending.erase(entry);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::vector<JournalEntry> Journal::get_pending_posts() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<JournalEntry> posts;
+    for (auto &entry : pending) {
+        if (entry.operation == POST_OPERATION) {
+            posts.push_back(entry);
+        }
+    }
+    return posts;
+}
+
+boost::optional<JournalEntry> Journal::find_pending_post(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &entry : pending) {
+        if (entry.operation == POST_OPERATION && entry.get_pending_name() == name) {
+            return boost::optional<JournalEntry>(entry);
+        }
+    }
+    return boost::optional<JournalEntry>();
+}
+
+bool Journal::is_pending_delete(const std::string &id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &entry : pending) {
+        if (entry.operation == DELETE_OPERATION && entry.argument == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Journal::run() {
+    std::chrono::seconds retry_delay = RETRY_MIN;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_available.wait(lock, [this]() { return stopping || !pending.empty(); });
+        if (stopping) {
+            return;
+        }
+
+        JournalEntry entry = pending.front();
+        in_flight = entry.sequence;
+        bool check_first = maybe_sent.count(entry.sequence) > 0;
+        lock.unlock();
+
+        json_spirit::mObject response;
+        if (check_first) {
+            response = find_post(entry);
+        }
+        if (!response.count("error") && !response.count("id")) {
+            response = apply(entry);
+        }
+
+        lock.lock();
+        if (FBGraph::is_retryable_error(response)) {
+            // Without a response, a post may still have been created
+            if (!FBGraph::is_transport_error(response)) {
+                std::cerr << "Could not " << entry.operation << " \""
+                          << entry.argument << "\" yet: "
+                          << response.at("error").get_obj().at("message").get_str()
+                          << std::endl;
+            } else if (entry.operation == POST_OPERATION) {
+                maybe_sent.insert(entry.sequence);
+            }
+
+            // Facebook is unreachable, busy, or wants a new token. Keep the
+            // entry and try again later; it may be withdrawn in the meantime.
+            in_flight = 0;
+            work_available.wait_for(lock, retry_delay, [this]() { return stopping; });
+            retry_delay = std::min(retry_delay * 2, RETRY_MAX);
+            continue;
+        }
+        retry_delay = RETRY_MIN;
+
+        if (response.count("error")) {
+            // Facebook refused it for good, so trying again won't help
+            std::cerr << "Could not " << entry.operation << " \""
+                      << entry.argument << "\": "
+                      << response.at("error").get_obj().at("message").get_str()
+                      << std::endl;
+        } else {
+            // Update the cached listings in place before the pending entry
+            // disappears, so that the change never looks undone
+            lock.unlock();
+            update_cache(entry, response);
+            lock.lock();
+        }
+
+        // Nothing but the worker removes the entry at the front while it's in
+        // flight
+        pending.pop_front();
+        maybe_sent.erase(entry.sequence);
+        in_flight = 0;
+        if (!append_done(entry.sequence)) {
+            std::cerr << "Could not update the journal at " << path << std::endl;
+        }
+    }
+}
+
+void Journal::update_cache(const JournalEntry &entry,
+                           const json_spirit::mObject &response) {
+    try {
+        if (entry.operation == POST_OPERATION && response.count("id")) {
+            graph.add_posted_status(response.at("id").get_str(), entry.argument);
+        } else if (entry.operation == DELETE_OPERATION) {
+            graph.remove_status(entry.argument);
+        }
+    } catch (std::exception &e) {
+        // The listing couldn't be patched, so fetch it again instead
+        graph.invalidate("me");
+    }
+}
+
+// Looks for a post among the user's recent statuses. If it's there, returns
+// its ID like Facebook does when posting, and otherwise an empty response.
+json_spirit::mObject Journal::find_post(const JournalEntry &entry) {
+    FBQuery query("me", "statuses");
+    query.add_parameter("date_format", "U");
+    query.add_parameter("fields", "id,message");
+    query.add_parameter("since", std::to_string(entry.time - CLOCK_SLACK));
+    json_spirit::mObject response = graph.fetch(query);
+    if (response.count("error")) {
+        return response;
+    }
+
+    json_spirit::mObject found;
+    for (auto &status_value : response.at("data").get_array()) {
+        const json_spirit::mObject &status = status_value.get_obj();
+        if (status.count("message") &&
+                status.at("message").get_str() == entry.argument) {
+            found["id"] = status.at("id").get_str();
+            break;
+        }
+    }
+
+    return found;
+}
+
+json_spirit::mObject Journal::apply(const JournalEntry &entry) {
+    try {
+        if (entry.operation == POST_OPERATION) {
+            // TODO: Allow writes to friend's walls as well. Unfortunately, it
+            // is not possible to post directly using the Facebook API.
+            // Instead, we will have to open a feed dialog.
+            // https://developers.facebook.com/docs/sharing/reference/feed-dialog
+            FBQuery query("me", "feed");
+            query.add_parameter("message", entry.argument);
+            return graph.post(query);
+        }
+
+        // The Facebook API requires the status ID to be appended to the user
+        // ID instead of just using the status ID. This is undocumented.
+        std::string node = graph.get_user() + "_" + entry.argument;
+        json_spirit::mValue response = graph.del(FBQuery(node));
+        if (response.type() == json_spirit::bool_type) {
+            return json_spirit::mObject();
+        }
+        return response.get_obj();
+    } catch (std::exception &e) {
+        // Most likely the user ID couldn't be fetched
+        json_spirit::mObject error;
+        error["message"] = e.what();
+        error["type"] = TRANSPORT_ERROR_TYPE;
+        error["code"] = static_cast<int>(TRANSPORT_FAILED);
+
+        json_spirit::mObject response;
+        response["error"] = error;
+        return response;
+    }
+}
@@ -0,0 +1,69 @@
+#include "NegativeCache.h"
+
+static const std::chrono::milliseconds DEFAULT_TTL(10000);
+
+// Expired entries are only swept once there are this many
+static const std::size_t MAX_ENTRIES = 4096;
+
+NegativeCache::NegativeCache() : ttl(DEFAULT_TTL), generation(0) {};
+
+void NegativeCache::set_ttl(const std::chrono::milliseconds ttl) noexcept {
+    this->ttl = ttl;
+}
+
+bool NegativeCache::contains(const std::string &path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = expiry_times.find(path);
+    if (entry == expiry_times.end()) {
+        return false;
+    }
+
+    if (entry->second <= std::chrono::steady_clock::now()) {
+        expiry_times.erase(entry);
+        return false;
+    }
+
+    return true;
+}
+
+void NegativeCache::add(const std::string &path) {
+    if (ttl <= std::chrono::milliseconds::zero()) {
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (expiry_times.size() >= MAX_ENTRIES) {
+        for (auto entry = expiry_times.begin(); entry != expiry_times.end();) {
+            if (entry->second <= now) {
+                entry = expiry_times.erase(entry);
+            } else {
+                ++entry;
+            }
+        }
+
+        // Everything is still fresh, so start over rather than grow
+        if (expiry_times.size() >= MAX_ENTRIES) {
+            expiry_times.clear();
+        }
+    }
+
+    expiry_times[path] = now + ttl;
+}
+
+// Called whenever a file may have appeared
+void NegativeCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    expiry_times.clear();
+}
+
+// Forgets every path if the listings they were missing from changed since the
+// last call, such as when a sync or a post added objects to them
+void NegativeCache::set_generation(const uint64_t current) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (current != generation) {
+        generation = current;
+        expiry_times.clear();
+    }
+}
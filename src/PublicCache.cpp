@@ -0,0 +1,26 @@
+#include "PublicCache.h"
+
+PublicCache::key_t PublicCache::make_key(const FBQuery &query) {
+    return std::make_tuple(query.get_node(), query.get_endpoint(),
+                           query.get_edge(), query.get_parameters());
+}
+
+boost::optional<json_spirit::mObject> PublicCache::find(const FBQuery &query) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto response = responses.find(make_key(query));
+    if (response == responses.end()) {
+        return boost::optional<json_spirit::mObject>();
+    }
+
+    return boost::optional<json_spirit::mObject>(response->second);
+}
+
+void PublicCache::put(const FBQuery &query, const json_spirit::mObject &response) {
+    std::lock_guard<std::mutex> lock(mutex);
+    responses[make_key(query)] = response;
+}
+
+std::size_t PublicCache::size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return responses.size();
+}
@@ -0,0 +1,200 @@
+#include "SearchIndex.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iterator>
+
+// How many rows may be added out of order before they are merged
+static const std::size_t MERGE_THRESHOLD = 16;
+
+PostingList::PostingList() : last(0), count(0) {};
+
+void PostingList::add(const row_t row) {
+    if (encoded.empty() || row > last) {
+        append(row);
+        return;
+    }
+
+    if (row == last) {
+        return;
+    }
+
+    unsorted.push_back(row);
+    ++count;
+    if (unsorted.size() >= MERGE_THRESHOLD) {
+        merge();
+    }
+}
+
+void PostingList::append(const row_t row) {
+    // The first row is stored as is
+    row_t delta = encoded.empty() ? row : row - last;
+    do {
+        uint8_t byte = delta & 0x7f;
+        delta >>= 7;
+        if (delta) {
+            byte |= 0x80;
+        }
+        encoded.push_back(byte);
+    } while (delta);
+
+    last = row;
+    ++count;
+}
+
+void PostingList::merge() {
+    std::vector<row_t> rows = get();
+    encoded.clear();
+    unsorted.clear();
+    count = 0;
+    for (row_t row : rows) {
+        append(row);
+    }
+
+    encoded.shrink_to_fit();
+    unsorted.shrink_to_fit();
+}
+
+std::vector<PostingList::row_t> PostingList::get() const {
+    std::vector<row_t> rows;
+    row_t row = 0;
+    std::size_t i = 0;
+    while (i < encoded.size()) {
+        row_t delta = 0;
+        unsigned shift = 0;
+        uint8_t byte;
+        do {
+            byte = encoded[i++];
+            delta |= static_cast<row_t>(byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        row += delta;
+        rows.push_back(row);
+    }
+
+    if (!unsorted.empty()) {
+        rows.insert(rows.end(), unsorted.begin(), unsorted.end());
+        std::sort(rows.begin(), rows.end());
+        rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    }
+
+    return rows;
+}
+
+std::size_t PostingList::size() const {
+    return count;
+}
+
+std::size_t PostingList::memory_usage() const {
+    return sizeof(PostingList) + encoded.capacity() +
+        unsorted.capacity() * sizeof(row_t);
+}
+
+SearchIndex::SearchIndex(StringArena &arena) : arena(arena) {};
+
+// Words are runs of letters and digits, compared without case. Bytes outside
+// of ASCII are kept as they are, so that words in other scripts still match.
+std::vector<std::string> SearchIndex::tokenize(const std::string &text) {
+    std::vector<std::string> words;
+    std::string word;
+    for (char c : text) {
+        unsigned char byte = static_cast<unsigned char>(c);
+        if (byte >= 0x80 || std::isalnum(byte)) {
+            word += static_cast<char>(std::tolower(byte));
+        } else if (!word.empty()) {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+
+    if (!word.empty()) {
+        words.push_back(word);
+    }
+
+    return words;
+}
+
+// Whether the text contains every word of the query
+bool SearchIndex::matches(const std::string &text, const std::string &query) {
+    std::vector<std::string> words = tokenize(text);
+    std::sort(words.begin(), words.end());
+
+    for (auto &term : tokenize(query)) {
+        if (!std::binary_search(words.begin(), words.end(), term)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void SearchIndex::add(const row_t row, const std::string &message) {
+    for (auto &word : tokenize(message)) {
+        StringArena::handle_t handle = arena.intern(word);
+        boost::optional<row_t> term = index.find(handle, terms);
+        if (!term) {
+            term = static_cast<row_t>(terms.size());
+            terms.push_back(handle);
+            postings.push_back(PostingList());
+            index.insert(handle, term.get(), terms);
+        }
+
+        postings[term.get()].add(row);
+    }
+}
+
+// Finds the rows that contain every word of the query. Rows are returned in
+// ascending order.
+std::vector<SearchIndex::row_t> SearchIndex::search(const std::string &query) const {
+    std::vector<const PostingList*> lists;
+    for (auto &word : tokenize(query)) {
+        boost::optional<StringArena::handle_t> handle = arena.find(word);
+        boost::optional<row_t> term;
+        if (handle) {
+            term = index.find(handle.get(), terms);
+        }
+
+        if (!term) {
+            // Nothing contains this word
+            return std::vector<row_t>();
+        }
+
+        lists.push_back(&postings[term.get()]);
+    }
+
+    if (lists.empty()) {
+        return std::vector<row_t>();
+    }
+
+    // Start with the shortest list, so the intersection only gets smaller
+    std::sort(lists.begin(), lists.end(),
+              [](const PostingList *a, const PostingList *b) {
+                  return a->size() < b->size();
+              });
+
+    std::vector<row_t> rows = lists.front()->get();
+    for (std::size_t i = 1; i < lists.size() && !rows.empty(); ++i) {
+        std::vector<row_t> other = lists[i]->get();
+        std::vector<row_t> intersection;
+        std::set_intersection(rows.begin(), rows.end(),
+                              other.begin(), other.end(),
+                              std::back_inserter(intersection));
+        rows.swap(intersection);
+    }
+
+    return rows;
+}
+
+std::size_t SearchIndex::size() const {
+    return terms.size();
+}
+
+std::size_t SearchIndex::memory_usage() const {
+    std::size_t usage = terms.capacity() * sizeof(StringArena::handle_t) +
+        index.memory_usage();
+    for (auto &list : postings) {
+        usage += list.memory_usage();
+    }
+    return usage;
+}
@@ -0,0 +1,470 @@
+#include "Store.h"
+
+#include <algorithm>
+#include <cstring>
+
+// Open addressing tables are grown before they are more than half full
+static const std::size_t INITIAL_SLOTS = 64;
+
+static uint32_t hash_bytes(const char *bytes, std::size_t length) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(bytes[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hash_handle(const StringArena::handle_t handle) {
+    // Knuth's multiplicative hash, since handles are clustered
+    return handle * 2654435761u;
+}
+
+StringArena::StringArena() : table(INITIAL_SLOTS, 0), interned(0) {};
+
+StringArena::handle_t StringArena::add(const std::string &value) {
+    handle_t handle = data.size();
+
+    // The length is stored as a variable-length integer, so short strings
+    // only need a single byte for it
+    std::size_t length = value.length();
+    do {
+        char byte = length & 0x7f;
+        length >>= 7;
+        if (length) {
+            byte |= 0x80;
+        }
+        data.push_back(byte);
+    } while (length);
+
+    data.insert(data.end(), value.begin(), value.end());
+    return handle;
+}
+
+StringArena::handle_t StringArena::intern(const std::string &value) {
+    boost::optional<handle_t> existing = find(value);
+    if (existing) {
+        return existing.get();
+    }
+
+    if ((interned + 1) * 2 > table.size()) {
+        grow_table();
+    }
+
+    handle_t handle = add(value);
+    std::size_t mask = table.size() - 1;
+    std::size_t slot = hash_bytes(value.data(), value.length()) & mask;
+    while (table[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    table[slot] = handle + 1;
+    ++interned;
+
+    return handle;
+}
+
+boost::optional<StringArena::handle_t> StringArena::find(const std::string &value) const {
+    std::size_t mask = table.size() - 1;
+    std::size_t slot = hash_bytes(value.data(), value.length()) & mask;
+    while (table[slot]) {
+        if (equals(table[slot] - 1, value)) {
+            return boost::optional<handle_t>(table[slot] - 1);
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return boost::optional<handle_t>();
+}
+
+std::string StringArena::get(const handle_t handle) const {
+    std::size_t length;
+    const char *bytes = contents(handle, length);
+    return std::string(bytes, length);
+}
+
+std::size_t StringArena::length(const handle_t handle) const {
+    std::size_t length;
+    contents(handle, length);
+    return length;
+}
+
+std::size_t StringArena::copy(const handle_t handle, char *buffer,
+                              std::size_t size, std::size_t offset) const {
+    std::size_t length;
+    const char *bytes = contents(handle, length);
+    if (offset >= length) {
+        return 0;
+    }
+
+    size = std::min(size, length - offset);
+    std::memcpy(buffer, bytes + offset, size);
+    return size;
+}
+
+bool StringArena::equals(const handle_t handle, const std::string &value) const {
+    std::size_t length;
+    const char *bytes = contents(handle, length);
+    return length == value.length() &&
+        std::memcmp(bytes, value.data(), length) == 0;
+}
+
+std::size_t StringArena::memory_usage() const {
+    return data.capacity() + table.capacity() * sizeof(handle_t);
+}
+
+const char* StringArena::contents(const handle_t handle, std::size_t &length) const {
+    const char *bytes = data.data() + handle;
+    length = 0;
+    unsigned shift = 0;
+    char byte;
+    do {
+        byte = *bytes++;
+        length |= static_cast<std::size_t>(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+
+    return bytes;
+}
+
+void StringArena::grow_table() {
+    std::vector<handle_t> old_table;
+    old_table.swap(table);
+    table.assign(old_table.size() * 2, 0);
+
+    std::size_t mask = table.size() - 1;
+    for (handle_t entry : old_table) {
+        if (!entry) {
+            continue;
+        }
+
+        std::size_t length;
+        const char *bytes = contents(entry - 1, length);
+        std::size_t slot = hash_bytes(bytes, length) & mask;
+        while (table[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        table[slot] = entry;
+    }
+}
+
+RowIndex::RowIndex() : slots(INITIAL_SLOTS, 0), count(0) {};
+
+boost::optional<RowIndex::row_t> RowIndex::find(const StringArena::handle_t key,
+        const std::vector<StringArena::handle_t> &keys) const {
+    std::size_t mask = slots.size() - 1;
+    std::size_t slot = hash_handle(key) & mask;
+    while (slots[slot]) {
+        if (keys[slots[slot] - 1] == key) {
+            return boost::optional<row_t>(slots[slot] - 1);
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return boost::optional<row_t>();
+}
+
+void RowIndex::insert(const StringArena::handle_t key, const row_t row,
+                      const std::vector<StringArena::handle_t> &keys) {
+    if ((count + 1) * 2 > slots.size()) {
+        grow(keys);
+    }
+
+    std::size_t mask = slots.size() - 1;
+    std::size_t slot = hash_handle(key) & mask;
+    while (slots[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = row + 1;
+    ++count;
+}
+
+void RowIndex::clear() {
+    slots.assign(INITIAL_SLOTS, 0);
+    count = 0;
+}
+
+std::size_t RowIndex::memory_usage() const {
+    return slots.capacity() * sizeof(row_t);
+}
+
+void RowIndex::grow(const std::vector<StringArena::handle_t> &keys) {
+    std::vector<row_t> old_slots;
+    old_slots.swap(slots);
+    slots.assign(old_slots.size() * 2, 0);
+
+    std::size_t mask = slots.size() - 1;
+    for (row_t entry : old_slots) {
+        if (!entry) {
+            continue;
+        }
+
+        std::size_t slot = hash_handle(keys[entry - 1]) & mask;
+        while (slots[slot]) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = entry;
+    }
+}
+
+Table::Table(StringArena &arena) : arena(arena) {};
+
+Table::~Table() {};
+
+boost::optional<Table::row_t> Table::find(const std::string &key) const {
+    boost::optional<StringArena::handle_t> handle = arena.find(key);
+    if (!handle) {
+        return boost::optional<row_t>();
+    }
+
+    boost::optional<row_t> row = index.find(handle.get(), keys);
+    if (row && removed[row.get()]) {
+        return boost::optional<row_t>();
+    }
+
+    return row;
+}
+
+void Table::remove(const std::string &key) {
+    boost::optional<row_t> row = find(key);
+    if (row) {
+        removed[row.get()] = true;
+    }
+}
+
+void Table::set_listing(const std::string &node, const std::vector<row_t> &rows) {
+    listings[arena.intern(node)] = rows;
+}
+
+// Adds a row to the front of a listing, if the listing is loaded. Facebook
+// lists newest objects first.
+void Table::prepend_to_listing(const std::string &node, const row_t row) {
+    boost::optional<StringArena::handle_t> handle = arena.find(node);
+    if (!handle || !listings.count(handle.get())) {
+        return;
+    }
+
+    std::vector<row_t> &listing = listings.at(handle.get());
+    if (std::find(listing.begin(), listing.end(), row) == listing.end()) {
+        listing.insert(listing.begin(), row);
+    }
+}
+
+void Table::remove_listing(const std::string &node) {
+    boost::optional<StringArena::handle_t> handle = arena.find(node);
+    if (handle) {
+        listings.erase(handle.get());
+    }
+}
+
+bool Table::has_listing(const std::string &node) const {
+    boost::optional<StringArena::handle_t> handle = arena.find(node);
+    return handle && listings.count(handle.get());
+}
+
+std::vector<Table::row_t> Table::get_listing(const std::string &node) const {
+    std::vector<row_t> rows;
+    boost::optional<StringArena::handle_t> handle = arena.find(node);
+    if (!handle || !listings.count(handle.get())) {
+        return rows;
+    }
+
+    for (row_t row : listings.at(handle.get())) {
+        if (!removed[row]) {
+            rows.push_back(row);
+        }
+    }
+
+    return rows;
+}
+
+std::string Table::get_key(const row_t row) const {
+    return arena.get(keys[row]);
+}
+
+std::size_t Table::size() const {
+    return keys.size();
+}
+
+std::size_t Table::memory_usage() const {
+    std::size_t usage = keys.capacity() * sizeof(StringArena::handle_t) +
+        removed.capacity() / 8 + index.memory_usage() + string_usage(keys);
+
+    // Approximate the size of a map node by three pointers and a color
+    for (auto &listing : listings) {
+        usage += 4 * sizeof(void*) + sizeof(listing) +
+            listing.second.capacity() * sizeof(row_t);
+    }
+
+    return usage;
+}
+
+Table::row_t Table::find_or_add(const std::string &key, bool &added) {
+    StringArena::handle_t handle = arena.intern(key);
+    boost::optional<row_t> row = index.find(handle, keys);
+    if (row) {
+        removed[row.get()] = false;
+        added = false;
+        return row.get();
+    }
+
+    row_t new_row = keys.size();
+    keys.push_back(handle);
+    removed.push_back(false);
+    index.insert(handle, new_row, keys);
+    added = true;
+    return new_row;
+}
+
+// Approximates the arena space used by strings, including their length
+// prefixes. Interned strings are counted once per reference.
+std::size_t Table::string_usage(const std::vector<StringArena::handle_t> &handles) const {
+    std::size_t usage = 0;
+    for (StringArena::handle_t handle : handles) {
+        usage += arena.length(handle) + 1;
+    }
+    return usage;
+}
+
+StatusTable::StatusTable(StringArena &arena) : Table(arena) {};
+
+Table::row_t StatusTable::put(const std::string &id, const int64_t updated_time,
+                              const std::string &message) {
+    bool added;
+    row_t row = find_or_add(id, added);
+    if (added) {
+        updated_times.push_back(updated_time);
+        messages.push_back(arena.add(message));
+        return row;
+    }
+
+    // Statuses are rarely edited, so avoid filling the arena with copies of
+    // the same message
+    updated_times[row] = updated_time;
+    if (!arena.equals(messages[row], message)) {
+        messages[row] = arena.add(message);
+    }
+
+    return row;
+}
+
+int64_t StatusTable::get_updated_time(const row_t row) const {
+    return updated_times[row];
+}
+
+std::size_t StatusTable::get_message_length(const row_t row) const {
+    return arena.length(messages[row]);
+}
+
+std::string StatusTable::get_message(const row_t row) const {
+    return arena.get(messages[row]);
+}
+
+std::size_t StatusTable::read_message(const row_t row, char *buffer,
+                                      std::size_t size, std::size_t offset) const {
+    return arena.copy(messages[row], buffer, size, offset);
+}
+
+// A changed message is always stored anew, so its handle identifies the
+// contents of the status
+uint32_t StatusTable::get_version(const row_t row) const {
+    return messages[row];
+}
+
+std::size_t StatusTable::memory_usage() const {
+    return Table::memory_usage() +
+        updated_times.capacity() * sizeof(int64_t) +
+        messages.capacity() * sizeof(StringArena::handle_t) +
+        string_usage(messages);
+}
+
+FriendTable::FriendTable(StringArena &arena) :
+    Table(arena), own_friends_loaded(false) {};
+
+Table::row_t FriendTable::put(const std::string &uid, const std::string &name) {
+    bool added;
+    row_t row = find_or_add(uid, added);
+    if (added) {
+        names.push_back(arena.intern(name));
+    } else {
+        names[row] = arena.intern(name);
+    }
+
+    return row;
+}
+
+void FriendTable::set_own_friends(const std::vector<row_t> &rows) {
+    set_listing("me", rows);
+
+    name_index.clear();
+    for (row_t row : rows) {
+        if (!name_index.find(names[row], names)) {
+            name_index.insert(names[row], row, names);
+        }
+    }
+    own_friends_loaded = true;
+}
+
+bool FriendTable::has_own_friends() const {
+    return own_friends_loaded;
+}
+
+boost::optional<Table::row_t> FriendTable::find_own_friend(const std::string &name) const {
+    boost::optional<StringArena::handle_t> handle = arena.find(name);
+    if (!handle) {
+        return boost::optional<row_t>();
+    }
+
+    return name_index.find(handle.get(), names);
+}
+
+std::string FriendTable::get_name(const row_t row) const {
+    return arena.get(names[row]);
+}
+
+std::size_t FriendTable::memory_usage() const {
+    return Table::memory_usage() + name_index.memory_usage() +
+        names.capacity() * sizeof(StringArena::handle_t) + string_usage(names);
+}
+
+AlbumTable::AlbumTable(StringArena &arena) : Table(arena) {};
+
+Table::row_t AlbumTable::put(const std::string &id, const std::string &name,
+                             const int64_t updated_time) {
+    bool added;
+    row_t row = find_or_add(id, added);
+    if (added) {
+        names.push_back(arena.intern(name));
+        updated_times.push_back(updated_time);
+    } else {
+        names[row] = arena.intern(name);
+        updated_times[row] = updated_time;
+    }
+
+    return row;
+}
+
+boost::optional<Table::row_t> AlbumTable::find_by_name(const std::string &node,
+        const std::string &name) const {
+    // Users only have a handful of albums, so a scan is fine
+    for (row_t row : get_listing(node)) {
+        if (arena.equals(names[row], name)) {
+            return boost::optional<row_t>(row);
+        }
+    }
+
+    return boost::optional<row_t>();
+}
+
+std::string AlbumTable::get_name(const row_t row) const {
+    return arena.get(names[row]);
+}
+
+int64_t AlbumTable::get_updated_time(const row_t row) const {
+    return updated_times[row];
+}
+
+std::size_t AlbumTable::memory_usage() const {
+    return Table::memory_usage() + names.capacity() * sizeof(StringArena::handle_t) +
+        updated_times.capacity() * sizeof(int64_t) + string_usage(names);
+}
@@ -0,0 +1,252 @@
+#include "Trace.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include "json_spirit.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// The number of spans kept for each thread. Older spans are overwritten.
+static const std::size_t BUFFER_CAPACITY = 8192;
+
+// The signal that asks for the spans recorded so far to be written out
+static const int DUMP_SIGNAL = SIGUSR1;
+
+static const std::string TRACE_ERROR = "Could not write the trace to ";
+
+namespace {
+
+class TraceEvent {
+    public:
+        const char *name;
+        const char *category;
+        char detail[TraceSpan::DETAIL_LENGTH];
+        int64_t start;
+        int64_t duration;
+        unsigned thread;
+};
+
+// The spans recorded by one thread. Only that thread writes to it, so
+// recording a span doesn't need a lock; the dump checks the count before and
+// after copying to skip any span that was overwritten while it read.
+class ThreadBuffer {
+    public:
+        ThreadBuffer() : events(BUFFER_CAPACITY), written(0) {};
+        std::vector<TraceEvent> events;
+        std::atomic<uint64_t> written;
+};
+
+// Buffers outlive their threads, since requests are sent from many short
+// lived threads. A buffer whose thread finished is reused by the next one.
+class BufferRegistry {
+    public:
+        std::shared_ptr<ThreadBuffer> acquire() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!idle.empty()) {
+                std::shared_ptr<ThreadBuffer> buffer = idle.back();
+                idle.pop_back();
+                return buffer;
+            }
+
+            buffers.push_back(std::make_shared<ThreadBuffer>());
+            return buffers.back();
+        }
+
+        void release(std::shared_ptr<ThreadBuffer> buffer) {
+            std::lock_guard<std::mutex> lock(mutex);
+            idle.push_back(buffer);
+        }
+
+        std::vector<std::shared_ptr<ThreadBuffer>> get_all() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return buffers;
+        }
+    private:
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+        std::vector<std::shared_ptr<ThreadBuffer>> idle;
+};
+
+// Holds the current thread's buffer, and hands it back when the thread ends
+class ThreadBufferHandle {
+    public:
+        ThreadBufferHandle();
+        ~ThreadBufferHandle();
+        std::shared_ptr<ThreadBuffer> buffer;
+        unsigned thread;
+};
+
+}
+
+static std::atomic<bool> enabled(false);
+static std::string trace_path;
+static std::chrono::steady_clock::time_point trace_start;
+static std::atomic<unsigned> next_thread(1);
+static int signal_pipe[2] = {-1, -1};
+
+static BufferRegistry& get_registry() {
+    // Never destroyed, since threads may still record spans during exit
+    static BufferRegistry *registry = new BufferRegistry();
+    return *registry;
+}
+
+ThreadBufferHandle::ThreadBufferHandle() :
+    buffer(get_registry().acquire()), thread(next_thread++) {};
+
+ThreadBufferHandle::~ThreadBufferHandle() {
+    get_registry().release(buffer);
+}
+
+static void on_dump_signal(int signal) {
+    (void)signal;
+
+    // Only async-signal-safe calls are allowed here, so the dump itself is
+    // left to a thread
+    char byte = 0;
+    ssize_t ignored = write(signal_pipe[1], &byte, 1);
+    (void)ignored;
+}
+
+static void wait_for_dump_signal() {
+    char byte;
+    while (read(signal_pipe[0], &byte, 1) == 1) {
+        Trace::dump();
+    }
+}
+
+// Starts recording spans, which are written to the given path when fbfs
+// receives SIGUSR1 or when Trace::dump() is called. Later calls do nothing.
+void Trace::enable(const std::string &path) {
+    static std::once_flag once;
+    std::call_once(once, [&path]() {
+        trace_path = path;
+        trace_start = std::chrono::steady_clock::now();
+
+        if (pipe(signal_pipe) == 0) {
+            struct sigaction action;
+            std::memset(&action, 0, sizeof(action));
+            action.sa_handler = on_dump_signal;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_RESTART;
+            sigaction(DUMP_SIGNAL, &action, NULL);
+            std::thread(wait_for_dump_signal).detach();
+        }
+
+        enabled = true;
+    });
+}
+
+bool Trace::is_enabled() {
+    return enabled.load(std::memory_order_relaxed);
+}
+
+bool Trace::dump() {
+    if (!is_enabled()) {
+        return false;
+    }
+
+    static std::mutex dump_mutex;
+    std::lock_guard<std::mutex> lock(dump_mutex);
+
+    json_spirit::mArray events;
+    for (auto &buffer : get_registry().get_all()) {
+        uint64_t end = buffer->written.load(std::memory_order_acquire);
+        uint64_t begin = end > BUFFER_CAPACITY ? end - BUFFER_CAPACITY : 0;
+        std::vector<TraceEvent> copied;
+        for (uint64_t i = begin; i < end; ++i) {
+            copied.push_back(buffer->events[i % BUFFER_CAPACITY]);
+        }
+
+        // The oldest spans may have been overwritten while they were copied,
+        // including the one that is being written right now
+        uint64_t written = buffer->written.load(std::memory_order_acquire);
+        uint64_t valid_from = written + 1 > BUFFER_CAPACITY ?
+            written + 1 - BUFFER_CAPACITY : 0;
+
+        for (uint64_t i = std::max(begin, valid_from); i < end; ++i) {
+            const TraceEvent &event = copied[i - begin];
+            json_spirit::mObject object;
+            object["name"] = event.name;
+            object["cat"] = event.category;
+            object["ph"] = "X";
+            object["ts"] = event.start;
+            object["dur"] = event.duration;
+            object["pid"] = static_cast<int>(getpid());
+            object["tid"] = static_cast<int>(event.thread);
+            if (event.detail[0]) {
+                json_spirit::mObject args;
+                args["detail"] = std::string(event.detail);
+                object["args"] = args;
+            }
+            events.push_back(object);
+        }
+    }
+
+    json_spirit::mObject trace;
+    trace["traceEvents"] = events;
+    trace["displayTimeUnit"] = "ms";
+
+    // Write to a temporary file first, so that a reader never sees half of
+    // a trace
+    std::string temporary_path = trace_path + ".tmp";
+    {
+        std::ofstream file(temporary_path);
+        file << json_spirit::write(trace);
+        if (!file) {
+            std::cerr << TRACE_ERROR << trace_path << std::endl;
+            return false;
+        }
+    }
+
+    if (std::rename(temporary_path.c_str(), trace_path.c_str()) != 0) {
+        std::cerr << TRACE_ERROR << trace_path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+TraceSpan::TraceSpan(const char *name, const char *category,
+                     const char *detail) :
+        active(Trace::is_enabled()), name(name), category(category) {
+    if (!active) {
+        return;
+    }
+
+    this->detail[0] = '\0';
+    if (detail) {
+        std::strncat(this->detail, detail, DETAIL_LENGTH - 1);
+    }
+    start = std::chrono::steady_clock::now();
+}
+
+TraceSpan::~TraceSpan() {
+    if (!active) {
+        return;
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    static thread_local ThreadBufferHandle handle;
+    ThreadBuffer &buffer = *handle.buffer;
+
+    uint64_t index = buffer.written.load(std::memory_order_relaxed);
+    TraceEvent &event = buffer.events[index % BUFFER_CAPACITY];
+    event.name = name;
+    event.category = category;
+    std::memcpy(event.detail, detail, sizeof(event.detail));
+    event.start = std::chrono::duration_cast<std::chrono::microseconds>(
+        start - trace_start).count();
+    event.duration = std::chrono::duration_cast<std::chrono::microseconds>(
+        end - start).count();
+    event.thread = handle.thread;
+    buffer.written.store(index + 1, std::memory_order_release);
+}
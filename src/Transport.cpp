@@ -0,0 +1,764 @@
+#include "Transport.h"
+#include "Trace.h"
+
+#include <CurlEasy.h>
+#include <CurlHttpPost.h>
+#include <CurlPair.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+// Retry parameters
+static const unsigned DEFAULT_MAX_RETRIES = 3;
+static const std::chrono::milliseconds DEFAULT_DEADLINE(30000);
+static const std::chrono::milliseconds BACKOFF_BASE(100);
+static const std::chrono::milliseconds BACKOFF_CAP(5000);
+
+// How often a waiting caller checks whether it has been interrupted
+static const std::chrono::milliseconds POLL_INTERVAL(50);
+
+// How many idle curl handles are kept for reuse
+static const std::size_t MAX_IDLE_HANDLES = 16;
+
+// How much written data an upload holds before writers have to wait for the
+// network to catch up
+static const std::size_t UPLOAD_BUFFER_SIZE = 1 << 20;
+static const std::string UPLOAD_BOUNDARY = "fbfs-upload-boundary-7d3c9a1e";
+
+// Hedging parameters
+static const std::size_t LATENCY_WINDOW = 256;
+static const std::size_t MIN_HEDGE_SAMPLES = 20;
+
+// State shared between the attempts of a single round. Attempts hold a
+// reference to it, so an attempt that loses the race may outlive the caller.
+class Exchange {
+    public:
+        Exchange() : finished(false), outstanding(0), cancelled(false) {};
+        std::mutex mutex;
+        std::condition_variable done;
+        bool finished;
+        unsigned outstanding;
+        Response response;
+        std::chrono::milliseconds latency;
+        std::atomic<bool> cancelled;
+};
+
+// Curl handles keep their connections open after a transfer, so reusing them
+// lets later requests skip the TCP and TLS handshakes. Attempts hold a
+// reference to the pool, since they may outlive the transport.
+class HandlePool {
+    public:
+        std::unique_ptr<curl::CurlEasy> acquire() {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (idle.empty()) {
+                return std::unique_ptr<curl::CurlEasy>(new curl::CurlEasy());
+            }
+
+            std::unique_ptr<curl::CurlEasy> handle(std::move(idle.back()));
+            idle.pop_back();
+            return handle;
+        }
+
+        void release(std::unique_ptr<curl::CurlEasy> handle) {
+            // Resetting forgets the options of the last request, which point
+            // at its buffers, but keeps the connections
+            handle->reset();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (idle.size() < MAX_IDLE_HANDLES) {
+                idle.push_back(std::move(handle));
+            }
+        }
+    private:
+        std::mutex mutex;
+        std::vector<std::unique_ptr<curl::CurlEasy>> idle;
+};
+
+// The deadline of the operation the current thread is working on, if any
+static thread_local std::chrono::steady_clock::time_point operation_deadline =
+    std::chrono::steady_clock::time_point::max();
+
+OperationDeadline::OperationDeadline(const std::chrono::milliseconds timeout) :
+        previous(operation_deadline) {
+    operation_deadline = std::min(operation_deadline,
+                                  std::chrono::steady_clock::now() + timeout);
+}
+
+OperationDeadline::~OperationDeadline() {
+    operation_deadline = previous;
+}
+
+std::chrono::steady_clock::time_point OperationDeadline::current() {
+    return operation_deadline;
+}
+
+bool OperationDeadline::is_active() {
+    return operation_deadline != std::chrono::steady_clock::time_point::max();
+}
+
+// Whether requests from the current thread are background work, and whether
+// that work has been stopped
+static thread_local bool background_thread = false;
+static thread_local std::function<bool()> background_stop_check;
+
+Response::Response() : status(0), interrupted(false), timed_out(false) {};
+
+bool Response::should_retry() const {
+    if (interrupted || timed_out) {
+        // The caller isn't waiting anymore
+        return false;
+    }
+
+    return !error.empty() || status == 0 || status == 429 || status >= 500;
+}
+
+Transport::Transport() :
+    deadline(DEFAULT_DEADLINE), max_retries(DEFAULT_MAX_RETRIES),
+    hedging(true), next_latency(0), interactive_requests(0),
+    random(std::random_device()()), max_rate(0), permits(0),
+    last_refill(std::chrono::steady_clock::now()),
+    handles(std::make_shared<HandlePool>()) {};
+
+void Transport::set_deadline(const std::chrono::milliseconds deadline) noexcept {
+    this->deadline = deadline;
+}
+
+void Transport::set_max_retries(const unsigned max_retries) noexcept {
+    this->max_retries = max_retries;
+}
+
+void Transport::set_hedging(const bool hedging) noexcept {
+    this->hedging = hedging;
+}
+
+void Transport::set_max_rate(const double requests_per_second) {
+    std::lock_guard<std::mutex> lock(mutex);
+    max_rate = std::max(requests_per_second, 0.0);
+    permits = 0;
+    last_refill = std::chrono::steady_clock::now();
+}
+
+void Transport::set_interrupt_check(const std::function<bool()> check) {
+    interrupt_check = check;
+}
+
+void Transport::set_background_thread(const bool is_background,
+                                      const std::function<bool()> stop_check) {
+    background_thread = is_background;
+    background_stop_check = stop_check;
+}
+
+static std::size_t write_callback(void *contents, std::size_t size,
+                                  std::size_t nmemb, void *userdata) {
+    std::size_t real_size = size * nmemb;
+    static_cast<std::string*>(userdata)->append(static_cast<char*>(contents), real_size);
+    return real_size;
+}
+
+static std::size_t header_callback(char *buffer, std::size_t size,
+                                   std::size_t nitems, void *userdata) {
+    std::size_t real_size = size * nitems;
+    std::string line(buffer, real_size);
+
+    // Redirects and "100 Continue" produce several status lines, so the last
+    // one wins
+    if (line.compare(0, 5, "HTTP/") == 0) {
+        std::size_t code_index = line.find(' ');
+        if (code_index != std::string::npos) {
+            static_cast<Response*>(userdata)->status =
+                std::strtol(line.c_str() + code_index + 1, NULL, 10);
+        }
+    }
+
+    return real_size;
+}
+
+static int progress_callback(void *clientp, curl_off_t dltotal,
+                             curl_off_t dlnow, curl_off_t ultotal,
+                             curl_off_t ulnow) {
+    (void)dltotal;
+    (void)dlnow;
+    (void)ultotal;
+    (void)ulnow;
+
+    // Returning non-zero aborts the transfer
+    return static_cast<std::atomic<bool>*>(clientp)->load() ? 1 : 0;
+}
+
+static Response attempt(curl::CurlEasy &request, const std::string &type,
+                        const std::string &url,
+                        const std::chrono::milliseconds timeout,
+                        std::atomic<bool> &cancelled) {
+    Response response;
+
+    if (type == "POST") {
+        CurlHttpPost post;
+        request.addOption(CurlPair<CURLoption,CurlHttpPost>(CURLOPT_HTTPPOST, post));
+    } else if (type == "DELETE") {
+        request.addOption(CurlPair<CURLoption,std::string>(CURLOPT_CUSTOMREQUEST, "DELETE"));
+    }
+
+    request.addOption(CurlPair<CURLoption,string>(CURLOPT_URL, url));
+    request.addOption(CurlPair<CURLoption,decltype(&write_callback)>(CURLOPT_WRITEFUNCTION, &write_callback));
+    request.addOption(CurlPair<CURLoption,std::string*>(CURLOPT_WRITEDATA, &response.body));
+    request.addOption(CurlPair<CURLoption,decltype(&header_callback)>(CURLOPT_HEADERFUNCTION, &header_callback));
+    request.addOption(CurlPair<CURLoption,Response*>(CURLOPT_HEADERDATA, &response));
+    // A timeout of zero would mean no timeout at all
+    request.addOption(CurlPair<CURLoption,long>(CURLOPT_TIMEOUT_MS,
+        std::max<long>(timeout.count(), 1)));
+
+    // Attempts run on their own threads, so timeouts must not use signals
+    request.addOption(CurlPair<CURLoption,long>(CURLOPT_NOSIGNAL, 1L));
+
+    request.addOption(CurlPair<CURLoption,long>(CURLOPT_NOPROGRESS, 0L));
+    request.addOption(CurlPair<CURLoption,decltype(&progress_callback)>(CURLOPT_XFERINFOFUNCTION, &progress_callback));
+    request.addOption(CurlPair<CURLoption,std::atomic<bool>*>(CURLOPT_XFERINFODATA, &cancelled));
+
+    try {
+        request.perform();
+    } catch (std::exception &e) {
+        response.error = e.what();
+    }
+
+    return response;
+}
+
+// Starts an attempt on its own thread. The caller must have already counted
+// the attempt in exchange->outstanding.
+static void spawn_attempt(std::shared_ptr<Exchange> exchange,
+                          std::shared_ptr<HandlePool> handles,
+                          const std::string &type, const std::string &url,
+                          const std::chrono::milliseconds timeout) {
+    std::thread([exchange, handles, type, url, timeout]() {
+        TraceSpan span("attempt", "transport");
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<curl::CurlEasy> request = handles->acquire();
+        Response response = attempt(*request, type, url, timeout,
+                                    exchange->cancelled);
+        handles->release(std::move(request));
+        auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+
+        std::lock_guard<std::mutex> lock(exchange->mutex);
+        --exchange->outstanding;
+        if (exchange->finished) {
+            return;
+        }
+
+        // The first usable response wins. A failure only ends the round if
+        // there is no other attempt left that could still succeed.
+        if (!response.should_retry() || exchange->outstanding == 0) {
+            exchange->finished = true;
+            exchange->response = response;
+            exchange->latency = latency;
+            exchange->done.notify_all();
+        }
+    }).detach();
+}
+
+Response Transport::perform(const std::string &type, const std::string &url) {
+    TraceSpan span("perform", "transport", type.c_str());
+    auto request_deadline = std::min(
+        std::chrono::steady_clock::now() + deadline,
+        OperationDeadline::current());
+
+    // Only GET requests are idempotent, so they are the only requests that
+    // are safe to retry or duplicate.
+    bool idempotent = type == "GET";
+    unsigned attempts = idempotent ? max_retries + 1 : 1;
+
+    if (!background_thread) {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++interactive_requests;
+    }
+
+    Response response;
+    for (unsigned i = 0; i < attempts; ++i) {
+        if (std::chrono::steady_clock::now() >= request_deadline) {
+            response.error = "Request deadline exceeded";
+            response.timed_out = true;
+            break;
+        }
+
+        if (i > 0) {
+            std::chrono::milliseconds pause = backoff(i);
+            auto resume_at = std::chrono::steady_clock::now() + pause;
+            if (resume_at >= request_deadline) {
+                response.timed_out = true;
+                break;
+            }
+
+            // The query string holds the access token, so it isn't logged
+            std::cerr << "Request failed, retrying in " << pause.count()
+                      << "ms: " << type << " " << url.substr(0, url.find('?'))
+                      << std::endl;
+            TraceSpan backoff_span("backoff", "transport");
+            if (!wait_until(resume_at)) {
+                response.interrupted = true;
+                break;
+            }
+        }
+
+        if (background_thread && !wait_for_interactive(request_deadline)) {
+            if (is_interrupted()) {
+                response.error = "Request interrupted";
+                response.interrupted = true;
+            } else {
+                response.error = "Request deadline exceeded";
+                response.timed_out = true;
+            }
+            break;
+        }
+
+        if (!wait_for_permit(request_deadline)) {
+            if (is_interrupted()) {
+                response.error = "Request interrupted";
+                response.interrupted = true;
+            } else {
+                response.error = "Request deadline exceeded";
+                response.timed_out = true;
+            }
+            break;
+        }
+
+        response = perform_round(type, url, request_deadline,
+                                 idempotent && hedging);
+        if (!response.should_retry()) {
+            break;
+        }
+    }
+
+    if (!background_thread) {
+        std::lock_guard<std::mutex> lock(mutex);
+        --interactive_requests;
+        interactive_done.notify_all();
+    }
+
+    return response;
+}
+
+// Returns false if the deadline passes or the caller is interrupted before
+// interactive requests are done
+bool Transport::wait_for_interactive(const std::chrono::steady_clock::time_point until) {
+    TraceSpan span("wait_for_interactive", "transport");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (interactive_requests > 0) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= until || is_interrupted()) {
+            return false;
+        }
+
+        interactive_done.wait_until(lock, std::min(now + POLL_INTERVAL, until));
+    }
+
+    return true;
+}
+
+// Takes a permit from the bucket, waiting for one if there are none left.
+// Returns false if the deadline would pass or the caller is interrupted first.
+bool Transport::wait_for_permit(const std::chrono::steady_clock::time_point until) {
+    TraceSpan span("wait_for_permit", "transport");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (max_rate > 0) {
+        auto now = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = now - last_refill;
+        last_refill = now;
+
+        // Allow bursts of up to one second's worth of requests
+        permits = std::min(permits + elapsed.count() * max_rate,
+                           std::max(max_rate, 1.0));
+        if (permits >= 1) {
+            permits -= 1;
+            return true;
+        }
+
+        auto available_at = now + std::chrono::duration_cast<
+            std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>((1 - permits) / max_rate));
+        if (available_at >= until) {
+            return false;
+        }
+
+        lock.unlock();
+        if (!wait_until(available_at)) {
+            return false;
+        }
+        lock.lock();
+    }
+
+    return true;
+}
+
+Response Transport::perform_round(const std::string &type,
+        const std::string &url,
+        const std::chrono::steady_clock::time_point round_deadline,
+        const bool should_hedge) {
+    auto exchange = std::make_shared<Exchange>();
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::milliseconds hedge_after = should_hedge ?
+        hedge_delay() : std::chrono::milliseconds::zero();
+
+    // If the request is slower than most, a duplicate is sent and whichever
+    // response arrives first is used.
+    bool hedged = hedge_after == std::chrono::milliseconds::zero();
+    auto hedge_at = start + hedge_after;
+
+    std::unique_lock<std::mutex> lock(exchange->mutex);
+
+    ++exchange->outstanding;
+    spawn_attempt(exchange, handles, type, url,
+        std::chrono::duration_cast<std::chrono::milliseconds>(round_deadline - start));
+
+    Response response;
+    while (!exchange->finished) {
+        auto now = std::chrono::steady_clock::now();
+
+        // Leave as soon as the caller has given up. The attempts are aborted
+        // below rather than waited for.
+        if (is_interrupted()) {
+            response.error = "Request interrupted";
+            response.interrupted = true;
+            break;
+        } else if (now >= round_deadline) {
+            response.error = "Request deadline exceeded";
+            response.timed_out = true;
+            break;
+        }
+
+        if (!hedged && now >= hedge_at) {
+            ++exchange->outstanding;
+            spawn_attempt(exchange, handles, type, url,
+                std::chrono::duration_cast<std::chrono::milliseconds>(round_deadline - now));
+            hedged = true;
+        }
+
+        auto wake_at = std::min(now + POLL_INTERVAL, round_deadline);
+        if (!hedged) {
+            wake_at = std::min(wake_at, hedge_at);
+        }
+        exchange->done.wait_until(lock, wake_at);
+    }
+
+    std::chrono::milliseconds latency = std::chrono::milliseconds::zero();
+    if (exchange->finished) {
+        response = exchange->response;
+        latency = exchange->latency;
+    }
+    lock.unlock();
+
+    // Abort any attempt that is still running, so that it releases its
+    // connection instead of finishing a transfer nobody will read
+    exchange->cancelled = true;
+
+    if (type == "GET" && exchange->finished && response.error.empty() &&
+            !response.should_retry()) {
+        record_latency(latency);
+    }
+
+    return response;
+}
+
+bool Transport::wait_until(const std::chrono::steady_clock::time_point time) {
+    while (std::chrono::steady_clock::now() < time) {
+        if (is_interrupted()) {
+            return false;
+        }
+
+        std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+            POLL_INTERVAL, time - std::chrono::steady_clock::now()));
+    }
+
+    return !is_interrupted();
+}
+
+bool Transport::is_interrupted() const {
+    if (background_stop_check && background_stop_check()) {
+        return true;
+    }
+
+    // Only threads working on an operation have anyone to interrupt them.
+    // Other threads, such as background workers, must not run the check.
+    return interrupt_check && OperationDeadline::is_active() && interrupt_check();
+}
+
+std::chrono::milliseconds Transport::hedge_delay() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (latencies.size() < MIN_HEDGE_SAMPLES) {
+        // Not enough samples to know what a slow request looks like
+        return std::chrono::milliseconds::zero();
+    }
+
+    std::vector<std::chrono::milliseconds> sorted(latencies);
+    auto p95 = sorted.begin() + (sorted.size() * 95) / 100;
+    std::nth_element(sorted.begin(), p95, sorted.end());
+    return std::max(*p95, std::chrono::milliseconds(1));
+}
+
+std::chrono::milliseconds Transport::backoff(const unsigned retry) {
+    // Exponential backoff with full jitter, so that clients that failed
+    // together don't retry together
+    std::chrono::milliseconds cap = std::min(BACKOFF_CAP,
+        BACKOFF_BASE * (1 << std::min(retry - 1, 16u)));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::uniform_int_distribution<long> distribution(0, cap.count());
+    return std::chrono::milliseconds(distribution(random));
+}
+
+void Transport::record_latency(const std::chrono::milliseconds latency) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (latencies.size() < LATENCY_WINDOW) {
+        latencies.push_back(latency);
+    } else {
+        latencies[next_latency] = latency;
+        next_latency = (next_latency + 1) % LATENCY_WINDOW;
+    }
+}
+
+// Starts sending the contents of a file as a multipart POST, without waiting
+// for the file to be written. Uploads aren't idempotent, so they are never
+// retried or hedged, but they do count against the rate limit.
+std::unique_ptr<Upload> Transport::start_upload(const std::string &url,
+                                                const std::string &field,
+                                                const std::string &filename,
+                                                Response &response) {
+    TraceSpan span("start_upload", "transport");
+    auto request_deadline = std::min(
+        std::chrono::steady_clock::now() + deadline,
+        OperationDeadline::current());
+    if (!wait_for_permit(request_deadline)) {
+        if (is_interrupted()) {
+            response.error = "Request interrupted";
+            response.interrupted = true;
+        } else {
+            response.error = "Request deadline exceeded";
+            response.timed_out = true;
+        }
+        return std::unique_ptr<Upload>();
+    }
+
+    std::unique_ptr<Upload> upload(new Upload(handles, interrupt_check, field, filename));
+    upload->start(url, deadline);
+    return upload;
+}
+
+std::size_t read_upload_body(char *buffer, std::size_t size,
+                             std::size_t nitems, void *userdata) {
+    return static_cast<Upload*>(userdata)->read(buffer, size * nitems);
+}
+
+Upload::Upload(std::shared_ptr<HandlePool> handles,
+               const std::function<bool()> interrupt_check,
+               const std::string &field, const std::string &filename) :
+    handles(handles), interrupt_check(interrupt_check),
+    timeout(0), buffer(UPLOAD_BUFFER_SIZE), head(0), used(0), written(0),
+    preamble_read(0), epilogue_read(0), closed(false), aborted(false),
+    done(false), cancelled(false) {
+    // Quotes and line breaks would end the header early
+    std::string quoted_name(filename);
+    std::replace_if(quoted_name.begin(), quoted_name.end(), [](char c) {
+        return c == '"' || c == '\r' || c == '\n';
+    }, '_');
+
+    preamble = "--" + UPLOAD_BOUNDARY + "\r\n"
+        "Content-Disposition: form-data; name=\"" + field +
+        "\"; filename=\"" + quoted_name + "\"\r\n"
+        "Content-Type: application/octet-stream\r\n\r\n";
+    epilogue = "\r\n--" + UPLOAD_BOUNDARY + "--\r\n";
+}
+
+Upload::~Upload() {
+    abort();
+}
+
+void Upload::start(const std::string &url,
+                   const std::chrono::milliseconds timeout) {
+    this->timeout = timeout;
+    transfer = std::thread(&Upload::send, this, url, timeout);
+}
+
+void Upload::send(const std::string &url,
+                  const std::chrono::milliseconds connect_timeout) {
+    TraceSpan span("upload", "transport");
+    std::unique_ptr<curl::CurlEasy> request = handles->acquire();
+    Response result;
+
+    // The length isn't known until the file is closed
+    curl_slist *headers = NULL;
+    headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
+    headers = curl_slist_append(headers, ("Content-Type: multipart/form-data; boundary=" +
+                                          UPLOAD_BOUNDARY).c_str());
+    headers = curl_slist_append(headers, "Expect:");
+
+    request->addOption(CurlPair<CURLoption,string>(CURLOPT_URL, url));
+    request->addOption(CurlPair<CURLoption,long>(CURLOPT_POST, 1L));
+    request->addOption(CurlPair<CURLoption,curl_slist*>(CURLOPT_HTTPHEADER, headers));
+    request->addOption(CurlPair<CURLoption,decltype(&read_upload_body)>(CURLOPT_READFUNCTION, &read_upload_body));
+    request->addOption(CurlPair<CURLoption,Upload*>(CURLOPT_READDATA, this));
+    request->addOption(CurlPair<CURLoption,decltype(&write_callback)>(CURLOPT_WRITEFUNCTION, &write_callback));
+    request->addOption(CurlPair<CURLoption,std::string*>(CURLOPT_WRITEDATA, &result.body));
+    request->addOption(CurlPair<CURLoption,decltype(&header_callback)>(CURLOPT_HEADERFUNCTION, &header_callback));
+    request->addOption(CurlPair<CURLoption,Response*>(CURLOPT_HEADERDATA, &result));
+
+    // The transfer lasts as long as the file is being written, so only
+    // connecting is given a deadline here. finish() bounds the rest.
+    request->addOption(CurlPair<CURLoption,long>(CURLOPT_CONNECTTIMEOUT_MS,
+        std::max<long>(connect_timeout.count(), 1)));
+    request->addOption(CurlPair<CURLoption,long>(CURLOPT_NOSIGNAL, 1L));
+
+    request->addOption(CurlPair<CURLoption,long>(CURLOPT_NOPROGRESS, 0L));
+    request->addOption(CurlPair<CURLoption,decltype(&progress_callback)>(CURLOPT_XFERINFOFUNCTION, &progress_callback));
+    request->addOption(CurlPair<CURLoption,std::atomic<bool>*>(CURLOPT_XFERINFODATA, &cancelled));
+
+    try {
+        request->perform();
+    } catch (std::exception &e) {
+        result.error = e.what();
+    }
+
+    handles->release(std::move(request));
+    curl_slist_free_all(headers);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (aborted && result.error.empty()) {
+        result.error = "Upload aborted";
+    }
+    response = result;
+    done = true;
+
+    // Writers waiting for space would otherwise wait forever
+    space_available.notify_all();
+    transfer_done.notify_all();
+}
+
+// Called by curl for more of the request body. This blocks until there is
+// data to send, which is fine since the transfer has its own thread.
+std::size_t Upload::read(char *out, std::size_t capacity) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (preamble_read < preamble.size()) {
+        std::size_t count = std::min(capacity, preamble.size() - preamble_read);
+        std::memcpy(out, preamble.data() + preamble_read, count);
+        preamble_read += count;
+        return count;
+    }
+
+    data_available.wait(lock, [this]() { return used > 0 || closed || aborted; });
+    if (aborted) {
+        return CURL_READFUNC_ABORT;
+    }
+
+    if (used > 0) {
+        // Only the contiguous part up to the end of the buffer is copied, the
+        // rest is left for the next call
+        std::size_t count = std::min(capacity,
+                                     std::min(used, buffer.size() - head));
+        std::memcpy(out, buffer.data() + head, count);
+        head = (head + count) % buffer.size();
+        used -= count;
+        space_available.notify_all();
+        return count;
+    }
+
+    std::size_t count = std::min(capacity, epilogue.size() - epilogue_read);
+    std::memcpy(out, epilogue.data() + epilogue_read, count);
+    epilogue_read += count;
+    return count;
+}
+
+// Copies data into the buffer, waiting for curl to make room if it's full.
+// Returns false if the upload failed or the caller gave up waiting.
+bool Upload::write(const char *data, std::size_t size) {
+    TraceSpan span("upload_write", "transport");
+    std::unique_lock<std::mutex> lock(mutex);
+    while (size > 0) {
+        if (done || aborted || closed) {
+            return false;
+        }
+
+        if (used == buffer.size()) {
+            if (is_interrupted() ||
+                    std::chrono::steady_clock::now() >= OperationDeadline::current()) {
+                return false;
+            }
+
+            space_available.wait_for(lock, POLL_INTERVAL);
+            continue;
+        }
+
+        std::size_t tail = (head + used) % buffer.size();
+        std::size_t count = std::min(size, std::min(buffer.size() - used,
+                                                     buffer.size() - tail));
+        std::memcpy(buffer.data() + tail, data, count);
+        used += count;
+        written += count;
+        data += count;
+        size -= count;
+        data_available.notify_all();
+    }
+
+    return true;
+}
+
+// Ends the body after the data written so far
+void Upload::close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed = true;
+    data_available.notify_all();
+}
+
+// Ends the body and waits for Facebook's response. A transfer that stalls,
+// or a server that never answers, is aborted once the timeout passes.
+Response Upload::finish() {
+    TraceSpan span("upload_finish", "transport");
+    close();
+
+    bool finished;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished = transfer_done.wait_for(lock, timeout, [this]() { return done; });
+    }
+
+    if (!finished) {
+        abort();
+    } else if (transfer.joinable()) {
+        transfer.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    Response result = response;
+    if (!finished) {
+        result.error = "Upload deadline exceeded";
+        result.timed_out = true;
+    }
+    return result;
+}
+
+void Upload::abort() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        aborted = true;
+        data_available.notify_all();
+    }
+    cancelled = true;
+
+    if (transfer.joinable()) {
+        transfer.join();
+    }
+}
+
+// The number of bytes written so far
+std::size_t Upload::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
+}
+
+bool Upload::is_interrupted() const {
+    return interrupt_check && OperationDeadline::is_active() && interrupt_check();
+}
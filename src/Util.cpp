@@ -1,7 +1,16 @@
 #include "Util.h"
 
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 
 bool confirm_yes(const std::string &prompt, bool assume_yes) {
@@ -27,3 +36,57 @@ bool confirm_yes(const std::string &prompt, bool assume_yes) {
 
     return response == "y";
 }
+
+std::string get_config_path(const std::string &name) {
+    boost::filesystem::path config_dir;
+    if (const char *xdg_config_home = std::getenv("XDG_CONFIG_HOME")) {
+        config_dir = xdg_config_home;
+    } else if (const char *home = std::getenv("HOME")) {
+        config_dir = boost::filesystem::path(home) / ".config";
+    } else {
+        config_dir = ".";
+    }
+
+    return (config_dir / "fbfs" / name).string();
+}
+
+boost::optional<std::string> read_file(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        return boost::optional<std::string>();
+    }
+
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return boost::optional<std::string>(contents.str());
+}
+
+bool write_private_file(const std::string &path, const std::string &contents) {
+    boost::filesystem::path file_path(path);
+    boost::system::error_code error;
+    boost::filesystem::create_directories(file_path.parent_path(), error);
+    if (error) {
+        return false;
+    }
+    chmod(file_path.parent_path().c_str(), 0700);
+
+    // Write to a temporary file first so that a crash never leaves a
+    // truncated file behind
+    std::string temp_path = path + ".tmp";
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) {
+        return false;
+    }
+
+    bool written = write(fd, contents.data(), contents.size()) ==
+        static_cast<ssize_t>(contents.size());
+    written = fsync(fd) == 0 && written;
+    close(fd);
+
+    if (!written || rename(temp_path.c_str(), path.c_str()) == -1) {
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,88 @@
+#include "WorkQueue.h"
+
+#include <exception>
+#include <iostream>
+
+WorkQueue::WorkQueue(const unsigned parallelism, const task_t thread_init) :
+    parallelism(parallelism), thread_init(thread_init), active_tasks(0),
+    stopping(false) {};
+
+WorkQueue::~WorkQueue() {
+    stop();
+}
+
+bool WorkQueue::enqueue(const task_t task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (stopping) {
+        return false;
+    }
+
+    tasks.push_back(task);
+    work_available.notify_one();
+    return true;
+}
+
+void WorkQueue::start() {
+    for (unsigned i = 0; i < parallelism; ++i) {
+        workers.push_back(std::thread(&WorkQueue::run, this));
+    }
+}
+
+// Waits until every task, including the ones enqueued by other tasks, is done
+void WorkQueue::wait() {
+    for (auto &worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+// Drops the tasks that haven't started and waits for the others
+void WorkQueue::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        tasks.clear();
+    }
+    work_available.notify_all();
+    wait();
+}
+
+bool WorkQueue::is_stopping() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stopping;
+}
+
+void WorkQueue::run() {
+    if (thread_init) {
+        thread_init();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        work_available.wait(lock, [this]() {
+            return stopping || !tasks.empty() || active_tasks == 0;
+        });
+
+        if (stopping || (tasks.empty() && active_tasks == 0)) {
+            // Either we were asked to stop or there's nothing left that
+            // could produce more work
+            work_available.notify_all();
+            return;
+        }
+
+        task_t task = tasks.front();
+        tasks.pop_front();
+        ++active_tasks;
+        lock.unlock();
+
+        try {
+            task();
+        } catch (std::exception &e) {
+            std::cerr << "Task failed: " << e.what() << std::endl;
+        }
+
+        lock.lock();
+        --active_tasks;
+        work_available.notify_all();
+    }
+}
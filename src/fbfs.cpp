@@ -1,33 +1,173 @@
 #define FUSE_USE_VERSION 26
 
+#include "Crawler.h"
+#include "Exporter.h"
 #include "FBGraph.h"
 #include "FBQuery.h"
+#include "Journal.h"
+#include "NegativeCache.h"
+#include "Trace.h"
 #include "Util.h"
 
+#include <boost/algorithm/string/trim.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
 #include <boost/range/adaptor/reversed.hpp>
 #include <fuse.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "json_spirit.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cerrno>
 #include <chrono>
+#include <csignal>
+#include <cstddef>
 #include <ctime>
 #include <cstring>
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <sstream>
 #include <string>
 #include <system_error>
-
-static std::chrono::time_point<std::chrono::system_clock> mount_time;
+#include <thread>
+#include <vector>
+
+// Options given with -o on the command line
+struct fbfs_options {
+    char *graph_url;
+    char *token_file;
+    char *journal;
+    char *trace;
+    int headless;
+    int deadline;
+    int op_deadline;
+    int retries;
+    int hedge;
+    int warmup;
+    int warmup_jobs;
+    int warmup_depth;
+    int warmup_budget;
+    int max_rate;
+    int negative_timeout;
+    int listing_ttl;
+    int reconcile_interval;
+};
+
+#define FBFS_OPT(t, p, v) { t, offsetof(struct fbfs_options, p), v }
+
+static const struct fuse_opt fbfs_opts[] = {
+    FBFS_OPT("graph_url=%s", graph_url, 0),
+    FBFS_OPT("token_file=%s", token_file, 0),
+    FBFS_OPT("journal=%s", journal, 0),
+    FBFS_OPT("trace=%s", trace, 0),
+    FBFS_OPT("headless", headless, 1),
+    FBFS_OPT("deadline=%i", deadline, 0),
+    FBFS_OPT("op_deadline=%i", op_deadline, 0),
+    FBFS_OPT("retries=%i", retries, 0),
+    FBFS_OPT("hedge", hedge, 1),
+    FBFS_OPT("nohedge", hedge, 0),
+    FBFS_OPT("warmup", warmup, 1),
+    FBFS_OPT("warmup_jobs=%i", warmup_jobs, 0),
+    FBFS_OPT("warmup_depth=%i", warmup_depth, 0),
+    FBFS_OPT("warmup_budget=%i", warmup_budget, 0),
+    FBFS_OPT("max_rate=%i", max_rate, 0),
+    FBFS_OPT("negative_ttl=%i", negative_timeout, 0),
+    FBFS_OPT("listing_ttl=%i", listing_ttl, 0),
+    FBFS_OPT("reconcile_interval=%i", reconcile_interval, 0),
+    FUSE_OPT_END
+};
+
+// Everything that belongs to one mounted account. FUSE passes it to every
+// operation as private_data.
+struct fbfs_mount {
+    fbfs_options options;
+
+    // Created by fbfs_init, unless the account was logged in beforehand
+    std::unique_ptr<FBGraph> graph;
+
+    // Where the journal is kept if the journal option isn't given
+    std::string journal_name;
+
+    std::chrono::time_point<std::chrono::system_clock> mount_time;
+
+    // The longest any single FUSE operation may spend waiting on Facebook
+    std::chrono::milliseconds operation_timeout;
+
+    // Prefetches data in the background after mounting, if enabled
+    std::unique_ptr<Crawler> crawler;
+
+    // Posts and deletions waiting to be sent to Facebook
+    std::unique_ptr<Journal> journal;
+
+    // The version of each status that getattr last described to the kernel.
+    // The kernel may keep the contents it cached for a status as long as the
+    // version hasn't changed since.
+    std::map<std::string, uint32_t> reported_versions;
+    std::mutex reported_versions_mutex;
+
+    // Paths that recently didn't exist
+    NegativeCache negative_cache;
+
+    // The only user allowed to use the mount, for mounts that other users
+    // could reach
+    boost::optional<uid_t> owner;
+
+    // Photos that are being written into albums, by path. They exist until
+    // they are closed, at which point the upload is finished.
+    std::map<std::string, std::shared_ptr<Upload>> uploads;
+    std::mutex uploads_mutex;
+};
 
 static const std::string LOGIN_ERROR = "You are not logged in, so the program cannot fetch your profile. Terminating.";
 static const std::string LOGIN_SUCCESS = "You are now logged into Facebook.";
 static const std::string PERMISSION_CHECK_ERROR = "Could not determine app permissions.";
 static const std::string POST_FILE_NAME = "post";
+static const std::string TOKEN_FILE_NAME = "access_token";
+static const std::string TOKEN_ENVIRONMENT_VARIABLE = "FBFS_ACCESS_TOKEN";
+static const std::string INVALID_TOKEN = "The saved access token is no longer valid.";
+static const std::string TOKEN_SAVE_ERROR = "Could not save the access token.";
+static const std::string JOURNAL_FILE_NAME = "journal";
+static const std::string JOURNAL_ERROR = "Could not open the journal at ";
+static const std::string SEARCH_DIRECTORY = "search";
+static const std::string SEARCH_PATH = "/" + SEARCH_DIRECTORY;
+static const std::string DUMP_COMMAND = "dump";
+static const std::string DAEMON_COMMAND = "daemon";
+static const std::string DAEMON_USAGE = "Usage: fbfs daemon MOUNT_LIST [-o OPTIONS]";
+static const std::string MOUNT_LIST_ERROR = "Could not read the list of mounts at ";
+static const std::string MOUNT_ERROR = "Could not mount ";
+static const std::string OWNER_ERROR = "Unknown owner ";
+static const std::string DAEMON_TOKEN_ERROR = "token_file must be given for each mount, not for the daemon";
+static const std::string MOUNT_TOKEN_ERROR = "No token_file was given for this mount";
+static const std::string TOKEN_OWNER_ERROR = "The token file does not belong to the owner: ";
+static const std::string NEGATIVE_OPTION_ERROR = "Option must not be negative: ";
+static const std::string DUMP_USAGE = "Usage: fbfs dump [-j JOBS] [--rate REQUESTS_PER_SECOND] [--token-file PATH] [--graph-url URL] DIRECTORY";
+
+static inline fbfs_mount* get_mount() {
+    return static_cast<fbfs_mount*>(fuse_get_context()->private_data);
+}
 
 static inline FBGraph* get_fb_graph() {
-    return static_cast<FBGraph*>(fuse_get_context()->private_data);
+    return get_mount()->graph.get();
+}
+
+static inline Journal* get_journal() {
+    return get_mount()->journal.get();
+}
+
+// Mounts served by the daemon are reachable by every user, but act with one
+// user's Facebook account, so only that user may use them
+static inline bool is_permitted() {
+    fbfs_mount *mount = get_mount();
+    return !mount->owner || fuse_get_context()->uid == mount->owner.get();
 }
 
 static inline std::string dirname(const std::string &path) {
@@ -39,6 +179,28 @@ static inline std::string basename(const std::string &path) {
     return boost::filesystem::basename(path);
 }
 
+// Whether the path is a status inside search/<terms>
+static inline bool is_search_result(const std::string &path) {
+    return dirname(dirname(path)) == SEARCH_PATH;
+}
+
+// The terms of a search directory. Unlike basename(), this keeps everything
+// after a dot.
+static inline std::string get_search_query(const std::string &path) {
+    return boost::filesystem::path(path).filename().string();
+}
+
+// Whether the path is a file inside one of the user's own albums. Photos
+// aren't listed, so these are only the photos being uploaded.
+static inline bool is_album_photo(const std::string &path) {
+    return dirname(dirname(path)) == "/albums";
+}
+
+// The name of an album or photo, including anything after a dot
+static inline std::string get_file_name(const std::string &path) {
+    return boost::filesystem::path(path).filename().string();
+}
+
 static inline std::set<std::string> get_endpoints() {
     return {
         "albums",
@@ -50,6 +212,17 @@ static inline std::set<std::string> get_endpoints() {
 static inline std::error_condition handle_error(const json_spirit::mObject response) {
     json_spirit::mObject error = response.at("error").get_obj();
     std::cerr << error.at("message").get_str() << std::endl;
+    if (error.at("type").get_str() == TRANSPORT_ERROR_TYPE) {
+        switch (error.at("code").get_int()) {
+            case TRANSPORT_INTERRUPTED:
+                return std::errc::interrupted;
+            case TRANSPORT_TIMED_OUT:
+                return std::errc::timed_out;
+            default:
+                return std::errc::io_error;
+        }
+    }
+
     if (error.at("type").get_str() == "OAuthException") {
         if (error.at("code").get_int() == 803) {
             return std::errc::no_such_file_or_directory;
@@ -80,6 +253,7 @@ static inline size_t depth_of_endpoint(const std::string &path) {
 }
 
 static inline std::string get_node_from_path(const std::string &path) {
+    TraceSpan span("get_node_from_path", "route");
     std::string p(path);
     std::string node;
 
@@ -87,8 +261,7 @@ static inline std::string get_node_from_path(const std::string &path) {
         return "me";
     }
 
-    std::set<std::string> friends = get_fb_graph()->get_friends();
-    while (!friends.count(basename(p))) {
+    while (!get_fb_graph()->is_friend(basename(p))) {
         if (dirname(p) == "/") {
             return "me";
         }
@@ -100,13 +273,99 @@ static inline std::string get_node_from_path(const std::string &path) {
     return get_fb_graph()->get_uid_from_name(friend_name);
 }
 
-static int fbfs_getattr(const char* cpath, struct stat *stbuf) {
-    std::string path(cpath);
+// Reads the access token saved in a file, if it holds one
+static boost::optional<std::string> read_access_token(const std::string &path) {
+    boost::optional<std::string> token = read_file(path);
+    if (token) {
+        boost::algorithm::trim(token.get());
+        if (token->empty()) {
+            token = boost::optional<std::string>();
+        }
+    }
+
+    return token;
+}
+
+// Finds an access token without asking the user. A token from the environment
+// or an explicit token file takes precedence over the one saved by a previous
+// interactive login.
+static boost::optional<std::string> find_access_token(const fbfs_options &options) {
+    if (const char *token = std::getenv(TOKEN_ENVIRONMENT_VARIABLE.c_str())) {
+        return boost::optional<std::string>(token);
+    }
+
+    return read_access_token(options.token_file ?
+                             options.token_file : get_config_path(TOKEN_FILE_NAME));
+}
+
+// Fills in the time and size of a status from Facebook, and remembers which
+// version of the status they describe
+static int stat_status_file(const std::string &path, struct stat *stbuf) {
+    std::error_condition result;
+    std::string id = basename(path);
+    time_t updated_time;
+    std::size_t size;
+    json_spirit::mObject status_response = (
+        get_fb_graph()->stat_status(id, updated_time, size));
+    if (status_response.count("error")) {
+        result = handle_error(status_response);
+        return -result.value();
+    }
+
+    timespec time;
+    time.tv_sec = updated_time;
+    stbuf->st_mtim = time;
+    stbuf->st_size = size;
+
+    boost::optional<uint32_t> version = get_fb_graph()->get_status_version(id);
+    if (version) {
+        fbfs_mount *mount = get_mount();
+        std::lock_guard<std::mutex> lock(mount->reported_versions_mutex);
+        mount->reported_versions[path] = version.get();
+    }
+    return 0;
+}
+
+// Status IDs are numbers, so any other name can't be a status on Facebook
+static inline bool is_status_id(const std::string &name) {
+    return !name.empty() &&
+        std::all_of(name.begin(), name.end(), [](char c) {
+            return c >= '0' && c <= '9';
+        });
+}
+
+// Statuses matching a search, except the ones that are about to be deleted
+static std::vector<std::string> search_statuses(const std::string &query) {
+    std::vector<std::string> ids = get_fb_graph()->search_statuses(query);
+    ids.erase(std::remove_if(ids.begin(), ids.end(), [](const std::string &id) {
+        return get_journal()->is_pending_delete(id);
+    }), ids.end());
+    return ids;
+}
+
+// Photos being uploaded are kept in the handle of the file that was created
+// for them. Other files have no handle.
+static inline std::shared_ptr<Upload>* get_upload(const struct fuse_file_info *fi) {
+    return reinterpret_cast<std::shared_ptr<Upload>*>(fi->fh);
+}
+
+static std::shared_ptr<Upload> find_upload(const std::string &path) {
+    fbfs_mount *mount = get_mount();
+    std::lock_guard<std::mutex> lock(mount->uploads_mutex);
+    auto upload = mount->uploads.find(path);
+    if (upload == mount->uploads.end()) {
+        return std::shared_ptr<Upload>();
+    }
+
+    return upload->second;
+}
+
+static int get_attributes(const std::string &path, struct stat *stbuf) {
     std::error_condition result;
     std::memset(stbuf, 0, sizeof(struct stat));
 
     timespec mount_timespec;
-    mount_timespec.tv_sec = std::chrono::system_clock::to_time_t(mount_time);
+    mount_timespec.tv_sec = std::chrono::system_clock::to_time_t(get_mount()->mount_time);
 
     if (path == "/" || path == "." || path == "..") {
         stbuf->st_mode = S_IFDIR | 0755;
@@ -115,6 +374,38 @@ static int fbfs_getattr(const char* cpath, struct stat *stbuf) {
         return 0;
     }
 
+    if (path == SEARCH_PATH || dirname(path) == SEARCH_PATH) {
+        // Any directory inside the search directory is a query
+        stbuf->st_mode = S_IFDIR | 0555;
+        stbuf->st_nlink = 2;
+        stbuf->st_mtim = mount_timespec;
+        return 0;
+    }
+
+    if (is_search_result(path)) {
+        std::vector<std::string> ids = search_statuses(get_search_query(dirname(path)));
+        if (std::find(ids.begin(), ids.end(), basename(path)) == ids.end()) {
+            result = std::errc::no_such_file_or_directory;
+            return -result.value();
+        }
+
+        stbuf->st_mode = S_IFREG | 0400;
+        return stat_status_file(path, stbuf);
+    }
+
+    if (is_album_photo(path)) {
+        std::shared_ptr<Upload> upload = find_upload(path);
+        if (!upload) {
+            result = std::errc::no_such_file_or_directory;
+            return -result.value();
+        }
+
+        stbuf->st_mode = S_IFREG | 0200;
+        stbuf->st_size = upload->size();
+        stbuf->st_mtim = mount_timespec;
+        return 0;
+    }
+
     if (basename(dirname(path)) == "friends") {
         // This is a directory representing a friend
         stbuf->st_mode = S_IFDIR | 0755;
@@ -138,42 +429,37 @@ static int fbfs_getattr(const char* cpath, struct stat *stbuf) {
         // This is a file inside an endpoint
         stbuf->st_mode = S_IFREG | 0400;
         if (basename(dirname(path)) == "status") {
-            // Store the date in the file
-            FBQuery query(basename(path));
-            query.add_parameter("date_format", "U");
-            query.add_parameter("fields", "message,updated_time");
-            json_spirit::mObject status_response = get_fb_graph()->get(query);
-            if (status_response.count("error")) {
-                result = handle_error(status_response);
+            boost::optional<JournalEntry> pending_post = (
+                get_journal()->find_pending_post(basename(path)));
+            if (pending_post) {
+                // This post hasn't been sent yet
+                timespec time;
+                time.tv_sec = pending_post->time;
+                stbuf->st_mtim = time;
+                stbuf->st_size = pending_post->argument.length();
+                return 0;
+            } else if (get_journal()->is_pending_delete(basename(path)) ||
+                    !is_status_id(basename(path))) {
+                result = std::errc::no_such_file_or_directory;
                 return -result.value();
             }
 
-            const time_t updated_time = status_response.at("updated_time").get_int();
-            timespec time;
-            time.tv_sec = updated_time;
-            stbuf->st_mtim = time;
-            stbuf->st_size = status_response.at("message").get_str().length();
+            // Store the date in the file
+            return stat_status_file(path, stbuf);
         } else if (basename(dirname(path)) == "albums") {
             // This is an album
             stbuf->st_mode = S_IFDIR | 0755;
-            std::string fql_query = (
-                "SELECT modified FROM album WHERE aid IN "
-                "(SELECT aid FROM album WHERE owner = me()) AND name = "
-                "\"" + basename(path) + "\"");
-
-            json_spirit::mObject response = get_fb_graph()->fql_get(fql_query);
+            time_t updated_time;
+            json_spirit::mObject response = get_fb_graph()->stat_album(
+                get_node_from_path(path), basename(path), updated_time);
             if (response.count("error")) {
                 result = handle_error(response);
                 return -result.value();
             }
 
-            json_spirit::mArray album_array = response.at("data").get_array();
-            if (album_array.size() > 0) {
-                const time_t updated_time = album_array[0].get_obj().at("modified").get_int();
-                timespec time;
-                time.tv_sec = updated_time;
-                stbuf->st_mtim = time;
-            }
+            timespec time;
+            time.tv_sec = updated_time;
+            stbuf->st_mtim = time;
 
             return 0;
         }
@@ -185,11 +471,41 @@ static int fbfs_getattr(const char* cpath, struct stat *stbuf) {
     return 0;
 }
 
+static int fbfs_getattr(const char *cpath, struct stat *stbuf) {
+    TraceSpan span("getattr", "fuse", cpath);
+    if (!is_permitted()) {
+        return -EACCES;
+    }
+    OperationDeadline deadline(get_mount()->operation_timeout);
+    std::string path(cpath);
+    NegativeCache &negative_cache = get_mount()->negative_cache;
+
+    negative_cache.set_generation(get_fb_graph()->get_listing_generation());
+    if (negative_cache.contains(path)) {
+        return -ENOENT;
+    }
+
+    int result = get_attributes(path, stbuf);
+
+    // Search results are found locally anyway, and change as more statuses
+    // are fetched
+    if (result == -ENOENT && !is_search_result(path)) {
+        negative_cache.add(path);
+    }
+
+    return result;
+}
+
 static int fbfs_unlink(const char *cpath) {
+    TraceSpan span("unlink", "fuse", cpath);
+    if (!is_permitted()) {
+        return -EACCES;
+    }
+    OperationDeadline deadline(get_mount()->operation_timeout);
     std::string path(cpath);
     std::error_condition result;
 
-    if (basename(path) == POST_FILE_NAME) {
+    if (basename(path) == POST_FILE_NAME || is_search_result(path)) {
         result = std::errc::permission_denied;
         return -result.value();
     }
@@ -198,19 +514,22 @@ static int fbfs_unlink(const char *cpath) {
     if (endpoints.count(basename(dirname(path)))) {
         // This is a file in an endpoint
         if (dirname(path) == "/status") {
-            // This is a user status, so we can delete it.
-            // The Facebook API requires the status ID to be appended to the
-            // user ID instead of just using the status ID. This is
-            // undocumented.
-            std::string node = get_fb_graph()->get_user() + "_" + basename(path);
-            FBQuery query(node);
-            json_spirit::mValue response = get_fb_graph()->del(query);
-            if (response.type() == json_spirit::bool_type) {
+            if (get_journal()->find_pending_post(basename(path))) {
+                // Withdraw the post, unless it is already being sent
+                if (!get_journal()->cancel(basename(path))) {
+                    result = std::errc::device_or_resource_busy;
+                    return -result.value();
+                }
                 return 0;
             }
 
-            result = handle_error(response.get_obj());
-            return -result.value();
+            // This is a user status, so we can delete it. The deletion is
+            // sent to Facebook in the background.
+            if (!get_journal()->remove(basename(path))) {
+                result = std::errc::io_error;
+                return -result.value();
+            }
+            return 0;
         }
     }
 
@@ -221,6 +540,11 @@ static int fbfs_readdir(const char *cpath, void *buf, fuse_fill_dir_t filler,
                         off_t offset, struct fuse_file_info *fi) {
     (void)offset;
     (void)fi;
+    TraceSpan span("readdir", "fuse", cpath);
+    if (!is_permitted()) {
+        return -EACCES;
+    }
+    OperationDeadline deadline(get_mount()->operation_timeout);
 
     std::string path(cpath);
     std::error_condition result;
@@ -233,22 +557,32 @@ static int fbfs_readdir(const char *cpath, void *buf, fuse_fill_dir_t filler,
         for (auto endpoint : endpoints) {
             filler(buf, endpoint.c_str(), NULL, 0);
         }
+        filler(buf, SEARCH_DIRECTORY.c_str(), NULL, 0);
+        return 0;
+    }
+
+    if (path == SEARCH_PATH) {
+        // Queries are looked up by name rather than listed
+        return 0;
+    } else if (dirname(path) == SEARCH_PATH) {
+        // Only statuses that were already fetched are searched, so this
+        // never has to wait on Facebook
+        for (auto &id : search_statuses(get_search_query(path))) {
+            filler(buf, id.c_str(), NULL, 0);
+        }
         return 0;
     }
 
-    std::set<std::string> friends = get_fb_graph()->get_friends();
     std::string node = get_node_from_path(path);
 
     std::cout << path << std::endl;
-    if (friends.count(basename(path))) {
+    if (get_fb_graph()->is_friend(basename(path))) {
         // We are in a friend's directory
         for (auto endpoint : endpoints) {
             if (endpoint == "friends") {
                 // The "friends" endpoint should only be shown if they have the
                 // app installed
-                FBQuery query(node);
-                query.add_parameter("fields", "installed");
-                json_spirit::mObject response = get_fb_graph()->get(query);
+                json_spirit::mObject response = get_fb_graph()->get_installed(node);
                 if (!response.at("installed").get_bool()) {
                     // Skip this endpoint if not installed
                     continue;
@@ -260,62 +594,54 @@ static int fbfs_readdir(const char *cpath, void *buf, fuse_fill_dir_t filler,
     } else if (endpoints.count(basename(path))) {
         std::string node = get_node_from_path(path);
 
-        json_spirit::mArray friends_list;
         if (basename(path) == "friends") {
-            if (node == "me") {
-                FBQuery query(node, "friends");
-                json_spirit::mObject friend_response = get_fb_graph()->get(query);
-                friends_list = friend_response.at("data").get_array();
-            } else {
-                // Get friends of a friend (we can only retrieve users who use
-                // the app)
-                std::string friends_of_friend_query = (
-                    "SELECT uid, name FROM user "
-                         "WHERE uid IN (SELECT uid2 FROM friend "
-                         "WHERE uid1 IN (SELECT uid FROM user "
-                         "WHERE uid IN (SELECT uid2 FROM friend "
-                         "WHERE uid1 = " + node + ") and is_app_user=1))");
-                json_spirit::mObject friend_response = (
-                        get_fb_graph()->fql_get(friends_of_friend_query));
-                if (friend_response.count("error")) {
-                    result = handle_error(friend_response);
-                    return -result.value();
-                }
-                friends_list = friend_response.at("data").get_array();
+            std::vector<std::string> friends_list;
+            json_spirit::mObject friend_response = (
+                get_fb_graph()->list_friends(node, friends_list));
+            if (friend_response.count("error")) {
+                result = handle_error(friend_response);
+                return -result.value();
             }
 
-            for (auto friend_obj : friends_list) {
-                std::string name = friend_obj.get_obj().at("name").get_str();
+            for (auto &name : friends_list) {
                 filler(buf, name.c_str(), NULL, 0);
             }
         } else if (basename(path) == "status") {
-            FBQuery query(node, "statuses");
-            query.add_parameter("date_format", "U");
-            query.add_parameter("fields", "updated_time,message,id");
-            json_spirit::mObject status_response = get_fb_graph()->get(query, true);
-            json_spirit::mArray statuses = status_response.at("data").get_array();
+            std::vector<std::string> statuses;
+            json_spirit::mObject status_response = (
+                get_fb_graph()->list_statuses(node, statuses));
+            if (status_response.count("error")) {
+                result = handle_error(status_response);
+                return -result.value();
+            }
 
             if (dirname(path) == "/") {
                 filler(buf, POST_FILE_NAME.c_str(), NULL, 0);
+
+                // Show our own changes before Facebook has them
+                for (auto &entry : get_journal()->get_pending_posts()) {
+                    filler(buf, entry.get_pending_name().c_str(), NULL, 0);
+                }
             }
 
-            for (auto& status : statuses) {
-                if (!status.get_obj().count("message")) {
-                    // The status doesn't have a message
+            for (auto &id : statuses) {
+                if (get_journal()->is_pending_delete(id)) {
                     continue;
                 }
-                std::string id = status.get_obj().at("id").get_str();
                 filler(buf, id.c_str(), NULL, 0);
             }
         } else if (path.find("albums") != std::string::npos) {
             if (depth_of_endpoint(path) == 0) {
                 // We are in the albums directory
-                FBQuery query(node, "albums");
-                json_spirit::mObject albums_response = get_fb_graph()->get(query);
-                json_spirit::mArray albums = albums_response.at("data").get_array();
+                std::vector<std::string> albums;
+                json_spirit::mObject albums_response = (
+                    get_fb_graph()->list_albums(node, albums));
+                if (albums_response.count("error")) {
+                    result = handle_error(albums_response);
+                    return -result.value();
+                }
 
-                for (auto& album : albums) {
-                    std::string album_name = album.get_obj().at("name").get_str();
+                for (auto &album_name : albums) {
                     filler(buf, album_name.c_str(), NULL, 0);
                 }
             }
@@ -326,6 +652,10 @@ static int fbfs_readdir(const char *cpath, void *buf, fuse_fill_dir_t filler,
 }
 
 static int fbfs_open(const char *cpath, struct fuse_file_info *fi) {
+    TraceSpan span("open", "fuse", cpath);
+    if (!is_permitted()) {
+        return -EACCES;
+    }
     std::string path(cpath);
     std::error_condition result;
 
@@ -333,27 +663,162 @@ static int fbfs_open(const char *cpath, struct fuse_file_info *fi) {
 
     std::string parent_folder = basename(dirname(path));
 
+    // A photo can only be written through the descriptor that created it,
+    // which is also the one that finishes the upload
+    if (is_album_photo(path)) {
+        result = std::errc::permission_denied;
+        return -result.value();
+    }
+
     if (fi->flags & O_RDONLY) {
         result = std::errc::permission_denied;
         return -result.value();
     }
 
+    if ((parent_folder == "status" && basename(path) != POST_FILE_NAME) ||
+            is_search_result(path)) {
+        // Pending posts never change, since they're withdrawn rather than
+        // edited. For other statuses, the cached contents are only kept if
+        // nothing changed since getattr described them. Edits are found when
+        // listings sync, so opening never has to ask Facebook.
+        if (get_journal()->find_pending_post(basename(path))) {
+            fi->keep_cache = 1;
+            return 0;
+        }
+
+        boost::optional<uint32_t> version = (
+            get_fb_graph()->get_status_version(basename(path)));
+        if (!version) {
+            return 0;
+        }
+
+        fbfs_mount *mount = get_mount();
+        std::lock_guard<std::mutex> lock(mount->reported_versions_mutex);
+        auto reported = mount->reported_versions.find(path);
+        fi->keep_cache = reported != mount->reported_versions.end() &&
+            reported->second == version.get();
+    }
+
+    return 0;
+}
+
+// Creating a file in an album uploads it as a photo. The photo is sent to
+// Facebook as it is written, rather than kept until it is closed.
+static int fbfs_create(const char *cpath, mode_t mode, struct fuse_file_info *fi) {
+    (void)mode;
+    TraceSpan span("create", "fuse", cpath);
+    if (!is_permitted()) {
+        return -EACCES;
+    }
+    OperationDeadline deadline(get_mount()->operation_timeout);
+    std::string path(cpath);
+    std::error_condition result;
+
+    if (!is_album_photo(path)) {
+        result = std::errc::permission_denied;
+        return -result.value();
+    }
+
+    std::unique_ptr<Upload> upload;
+    json_spirit::mObject response = get_fb_graph()->start_photo_upload(
+        "me", get_file_name(dirname(path)), get_file_name(path), upload);
+    if (response.count("error")) {
+        result = handle_error(response);
+        return -result.value();
+    } else if (!upload) {
+        result = std::errc::no_such_file_or_directory;
+        return -result.value();
+    }
+
+    fbfs_mount *mount = get_mount();
+    std::shared_ptr<Upload> shared_upload(std::move(upload));
+    {
+        std::lock_guard<std::mutex> lock(mount->uploads_mutex);
+        if (mount->uploads.count(path)) {
+            // The new upload is aborted when it goes out of scope
+            result = std::errc::device_or_resource_busy;
+            return -result.value();
+        }
+        mount->uploads[path] = shared_upload;
+    }
+    fi->fh = reinterpret_cast<uint64_t>(new std::shared_ptr<Upload>(shared_upload));
+
+    // The photo may have been looked up before it was created
+    mount->negative_cache.clear();
+
+    return 0;
+}
+
+// Finishes uploading a photo once the descriptor that created it is closed
+static int fbfs_release(const char *cpath, struct fuse_file_info *fi) {
+    TraceSpan span("release", "fuse", cpath);
+    std::string path(cpath);
+
+    std::shared_ptr<Upload> *handle = get_upload(fi);
+    if (!handle) {
+        return 0;
+    }
+
+    std::shared_ptr<Upload> upload = *handle;
+    delete handle;
+    fi->fh = 0;
+    {
+        fbfs_mount *mount = get_mount();
+        std::lock_guard<std::mutex> lock(mount->uploads_mutex);
+        auto found = mount->uploads.find(path);
+        if (found != mount->uploads.end() && found->second == upload) {
+            mount->uploads.erase(found);
+        }
+    }
+
+    // Nobody waits for release, so a failed upload can only be logged
+    json_spirit::mObject response = get_fb_graph()->finish_photo_upload(*upload);
+    if (response.count("error")) {
+        handle_error(response);
+    }
+
     return 0;
 }
 
 static int fbfs_truncate(const char *cpath, off_t size) {
     (void)cpath;
     (void)size;
+    if (!is_permitted()) {
+        return -EACCES;
+    }
+
     return 0;
 }
 
 static int fbfs_write(const char *cpath, const char *buf, size_t size,
                       off_t offset, struct fuse_file_info *fi) {
-    (void)fi;
+    TraceSpan span("write", "fuse", cpath);
+    if (!is_permitted()) {
+        return -EACCES;
+    }
+    OperationDeadline deadline(get_mount()->operation_timeout);
     std::error_condition result;
     std::string path(cpath);
     std::set<std::string> endpoints = get_endpoints();
 
+    if (std::shared_ptr<Upload> *handle = get_upload(fi)) {
+        Upload *upload = handle->get();
+
+        // The photo is streamed as it's written, so it can't be written out
+        // of order
+        if (static_cast<std::size_t>(offset) != upload->size()) {
+            result = std::errc::invalid_seek;
+            return -result.value();
+        }
+
+        if (!upload->write(buf, size)) {
+            result = std::errc::io_error;
+            return -result.value();
+        }
+
+        return size;
+    }
+
     if (endpoints.count(basename(dirname(path)))) {
         // We are in an endpoint directory, so we are able to write the file
         const char *start = buf + offset;
@@ -362,18 +827,17 @@ static int fbfs_write(const char *cpath, const char *buf, size_t size,
         std::string endpoint = basename(dirname(path));
 
         if (endpoint == "status") {
-            // TODO: Allow writes to friend's walls as well. Unfortunately, it
-            // is not possible to post directly using the Facebook API.
-            // Instead, we will have to open a feed dialog.
-            // https://developers.facebook.com/docs/sharing/reference/feed-dialog
-            FBQuery query("me", "feed");
-            query.add_parameter("message", data);
-            json_spirit::mObject response = get_fb_graph()->post(query);
-            if (response.count("error")) {
-                result = handle_error(response);
+            // The post is acknowledged once it's in the journal, and sent to
+            // Facebook in the background
+            if (!get_journal()->post(data)) {
+                result = std::errc::io_error;
                 return -result.value();
             }
 
+            // The post is listed under a new name, which may have been
+            // looked up before
+            get_mount()->negative_cache.clear();
+
             return data.size();
         }
     }
@@ -384,31 +848,133 @@ static int fbfs_write(const char *cpath, const char *buf, size_t size,
 static int fbfs_read(const char *cpath, char *buf, size_t size, off_t offset,
                      struct fuse_file_info *fi) {
     (void)fi;
+    TraceSpan span("read", "fuse", cpath);
+    if (!is_permitted()) {
+        return -EACCES;
+    }
+    OperationDeadline deadline(get_mount()->operation_timeout);
     std::string path(cpath);
     std::error_condition result;
 
-    FBQuery query(basename(path));
-    query.add_parameter("fields", "message");
-    json_spirit::mObject status_response = get_fb_graph()->get(query, true);
-    std::string message = status_response.at("message").get_str();
+    boost::optional<JournalEntry> pending_post = (
+        get_journal()->find_pending_post(basename(path)));
+    if (pending_post) {
+        const std::string &message = pending_post->argument;
+        if (static_cast<std::size_t>(offset) >= message.length()) {
+            return 0;
+        }
+
+        size = std::min(size, message.length() - offset);
+        std::memcpy(buf, message.data() + offset, size);
+        return size;
+    }
 
-    if (static_cast<unsigned>(offset) < message.length()) {
-        if (offset + size > message.length()) {
-            size = message.length() - offset;
+    std::size_t count;
+    json_spirit::mObject status_response = get_fb_graph()->read_status(
+        basename(path), buf, size, offset, count);
+    if (status_response.count("error")) {
+        result = handle_error(status_response);
+        return -result.value();
+    }
+
+    return count;
+}
+
+static void configure_transport(Transport &transport, const fbfs_options &options) {
+    transport.set_deadline(std::chrono::milliseconds(options.deadline));
+    transport.set_max_retries(options.retries);
+    transport.set_hedging(options.hedge);
+    transport.set_max_rate(options.max_rate);
+
+    // Requests are abandoned as soon as the process that made the system
+    // call is interrupted
+    transport.set_interrupt_check([]() { return fuse_interrupted() != 0; });
+}
+
+// Reuse an existing token if there is one, so that the browser (and Qt along
+// with it) is only started when the user really has to log in
+static void log_in_with_token(FBGraph &fb_graph,
+                              const boost::optional<std::string> &token) {
+    if (token) {
+        fb_graph.set_access_token(token.get());
+        if (!fb_graph.validate_access_token()) {
+            std::cout << INVALID_TOKEN << std::endl;
         }
+    }
+}
 
-        std::memcpy(buf, message.c_str() + offset, size);
-    } else {
-        size = 0;
+static void log_in_with_saved_token(FBGraph &fb_graph, const fbfs_options &options) {
+    log_in_with_token(fb_graph, find_access_token(options));
+}
+
+// Reads the token of a mount served by the daemon. It must come from the
+// mount's own token file, owned by the mount's owner, since the daemon's
+// environment and saved token belong to whoever runs the daemon.
+static boost::optional<std::string> find_owner_token(const fbfs_options &options,
+                                                     const uid_t owner) {
+    if (!options.token_file) {
+        std::cerr << MOUNT_TOKEN_ERROR << std::endl;
+        return boost::optional<std::string>();
+    }
+
+    struct stat token_stat;
+    if (stat(options.token_file, &token_stat) != 0 ||
+            !S_ISREG(token_stat.st_mode) || token_stat.st_uid != owner) {
+        std::cerr << TOKEN_OWNER_ERROR << options.token_file << std::endl;
+        return boost::optional<std::string>();
+    }
+
+    return read_access_token(options.token_file);
+}
+
+static bool open_journal(fbfs_mount &mount) {
+    const fbfs_options &options = mount.options;
+    std::string journal_path = options.journal ?
+        options.journal : get_config_path(mount.journal_name);
+    mount.journal.reset(new Journal(*mount.graph, journal_path));
+    if (!mount.journal->open()) {
+        std::cerr << JOURNAL_ERROR << journal_path << std::endl;
+        mount.journal.reset();
+        return false;
     }
 
-    return size;
+    return true;
 }
 
 static void* fbfs_init(struct fuse_conn_info *ci) {
+#ifdef FUSE_CAP_AUTO_INVAL_DATA
+    // Cached contents are dropped once getattr reports a new time or size,
+    // so a status that was edited before it was looked up again isn't read
+    // from stale pages either
+    if (ci->capable & FUSE_CAP_AUTO_INVAL_DATA) {
+        ci->want |= FUSE_CAP_AUTO_INVAL_DATA;
+    }
+#else
     (void)ci;
+#endif
+
+    fbfs_mount *mount = static_cast<fbfs_mount*>(fuse_get_context()->private_data);
+    fbfs_options *options = &mount->options;
+    mount->operation_timeout = std::chrono::milliseconds(options->op_deadline);
+    mount->negative_cache.set_ttl(std::chrono::seconds(options->negative_timeout));
+
+    // This runs after FUSE has forked into the background, so the thread
+    // that writes traces survives
+    if (options->trace) {
+        Trace::enable(options->trace);
+    }
+
+    if (!mount->graph) {
+        mount->graph.reset(new FBGraph());
+        if (options->graph_url) {
+            mount->graph->set_graph_url(options->graph_url);
+        }
+        configure_transport(mount->graph->get_transport(), *options);
+    }
 
-    FBGraph *fb_graph = new FBGraph();
+    FBGraph *fb_graph = mount->graph.get();
+    fb_graph->set_listing_ttl(std::chrono::seconds(options->listing_ttl));
+    fb_graph->set_reconcile_interval(std::chrono::seconds(options->reconcile_interval));
 
     // We will ask for both user and friend variants of these permissions.
     // Refer to https://developers.facebook.com/docs/facebook-login/permissions
@@ -423,7 +989,19 @@ static void* fbfs_init(struct fuse_conn_info *ci) {
         "publish_actions",
     };
 
-    fb_graph->login(permissions, extended_permissions);
+    if (!fb_graph->is_logged_in()) {
+        log_in_with_saved_token(*fb_graph, *options);
+    }
+
+    if (!options->headless && !fb_graph->is_logged_in()) {
+        fb_graph->login(permissions, extended_permissions);
+
+        if (fb_graph->is_logged_in() &&
+                !write_private_file(get_config_path(TOKEN_FILE_NAME),
+                                    fb_graph->get_access_token())) {
+            std::cerr << TOKEN_SAVE_ERROR << std::endl;
+        }
+    }
 
     if (!fb_graph->is_logged_in()) {
         std::cout << LOGIN_ERROR << std::endl;
@@ -434,13 +1012,33 @@ static void* fbfs_init(struct fuse_conn_info *ci) {
 
     // Store the time that the filesystem was mounted
     std::chrono::system_clock clock;
-    mount_time = clock.now();
+    mount->mount_time = clock.now();
+
+    // The daemon opens journals before mounting, so that a journal that
+    // can't be opened only stops its own mount
+    if (!mount->journal && !open_journal(*mount)) {
+        std::exit(EXIT_FAILURE);
+    }
 
-    return fb_graph;
+    if (options->warmup) {
+        mount->crawler.reset(new Crawler(*fb_graph, options->warmup_jobs,
+                                         options->warmup_depth,
+                                         options->warmup_budget));
+        mount->crawler->start();
+    }
+
+    return mount;
 }
 
 static void fbfs_destroy(void *private_data) {
-    delete static_cast<FBGraph*>(private_data);
+    fbfs_mount *mount = static_cast<fbfs_mount*>(private_data);
+
+    // These use the graph, so they have to finish first
+    mount->crawler.reset();
+    mount->journal.reset();
+    mount->graph.reset();
+
+    Trace::dump();
 }
 
 static struct fuse_operations fbfs_oper;
@@ -457,6 +1055,319 @@ void initialize_operations(fuse_operations& operations) {
     operations.destroy  = fbfs_destroy;
     operations.truncate = fbfs_truncate;
     operations.write    = fbfs_write;
+    operations.create   = fbfs_create;
+    operations.release  = fbfs_release;
+}
+
+static void set_default_options(fbfs_options &options) {
+    options.graph_url = NULL;
+    options.token_file = NULL;
+    options.journal = NULL;
+    options.trace = NULL;
+    options.headless = 0;
+    options.deadline = 30000;
+    options.op_deadline = 60000;
+    options.retries = 3;
+    options.hedge = 1;
+    options.warmup = 0;
+    options.warmup_jobs = 4;
+    options.warmup_depth = 1;
+    options.warmup_budget = 500;
+    options.max_rate = 0;
+    options.negative_timeout = 10;
+    options.listing_ttl = 60;
+    options.reconcile_interval = 600;
+}
+
+// Rejects option values that fuse_opt can't rule out by itself
+static bool check_options(const fbfs_options &options) {
+    // Counts end up unsigned, and negative durations would time out at once
+    const std::vector<std::pair<std::string, int>> counts = {
+        { "deadline", options.deadline },
+        { "op_deadline", options.op_deadline },
+        { "retries", options.retries },
+        { "warmup_jobs", options.warmup_jobs },
+        { "warmup_depth", options.warmup_depth },
+        { "warmup_budget", options.warmup_budget },
+        { "max_rate", options.max_rate },
+        { "negative_ttl", options.negative_timeout },
+        { "listing_ttl", options.listing_ttl },
+        { "reconcile_interval", options.reconcile_interval },
+    };
+
+    bool valid = true;
+    for (auto &count : counts) {
+        if (count.second < 0) {
+            std::cerr << NEGATIVE_OPTION_ERROR << count.first << std::endl;
+            valid = false;
+        }
+    }
+
+    return valid;
+}
+
+// Exports the account into a directory instead of mounting it. This talks to
+// the Graph API directly, so that many requests can be in flight at once.
+static int run_dump(int argc, char *argv[]) {
+    fbfs_options options;
+    set_default_options(options);
+
+    unsigned jobs = 16;
+    double rate = 0;
+    std::string directory;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg(argv[i]);
+        bool has_value = i + 1 < argc;
+        if ((arg == "-j" || arg == "--jobs") && has_value) {
+            jobs = std::max(std::atoi(argv[++i]), 1);
+        } else if (arg == "--rate" && has_value) {
+            rate = std::atof(argv[++i]);
+        } else if (arg == "--token-file" && has_value) {
+            options.token_file = argv[++i];
+        } else if (arg == "--graph-url" && has_value) {
+            options.graph_url = argv[++i];
+        } else if (directory.empty() && arg[0] != '-') {
+            directory = arg;
+        } else {
+            directory.clear();
+            break;
+        }
+    }
+
+    if (directory.empty()) {
+        std::cerr << DUMP_USAGE << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    FBGraph fb_graph;
+    if (options.graph_url) {
+        fb_graph.set_graph_url(options.graph_url);
+    }
+
+    // Duplicate requests would only use up the rate limit
+    Transport &transport = fb_graph.get_transport();
+    transport.set_deadline(std::chrono::milliseconds(options.deadline));
+    transport.set_max_retries(options.retries);
+    transport.set_hedging(false);
+    transport.set_max_rate(rate);
+
+    log_in_with_saved_token(fb_graph, options);
+    if (!fb_graph.is_logged_in()) {
+        std::cerr << LOGIN_ERROR << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    Exporter exporter(fb_graph, directory, jobs);
+    return exporter.run();
+}
+
+// Lets the kernel remember missing paths as well, so that repeated lookups
+// don't even reach fbfs
+static void add_negative_timeout(struct fuse_args &args, const fbfs_options &options) {
+    fuse_opt_add_arg(&args, ("-onegative_timeout=" +
+                             std::to_string(options.negative_timeout)).c_str());
+}
+
+// Looks up a user by name or by uid
+static struct passwd* find_user(const std::string &name) {
+    if (name.empty()) {
+        return NULL;
+    }
+
+    if (std::all_of(name.begin(), name.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+        return getpwuid(static_cast<uid_t>(std::stoul(name)));
+    }
+
+    return getpwnam(name.c_str());
+}
+
+// A mount served by the daemon, with its own FUSE loop
+struct daemon_mount {
+    std::string mountpoint;
+    fbfs_mount state;
+    struct fuse_chan *channel;
+    struct fuse *fuse;
+    std::thread loop;
+};
+
+// Mounts every account in a list, all served by this one process. The
+// accounts share a transport (and with it, connections and the rate limit)
+// and a cache of public responses, but keep their own caches otherwise.
+//
+// Each line of the list is a mount point and the user who owns it, optionally
+// followed by options for that mount in the same form as -o. Options given
+// after the list apply to every mount, and also set up the shared transport.
+//
+// The daemon usually runs as another user than the owners, so mounts allow
+// other users in, show their files as the owner's, and turn away everyone
+// but the owner.
+static int run_daemon(int argc, char *argv[]) {
+    if (argc < 3) {
+        std::cerr << DAEMON_USAGE << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream mount_list(argv[2]);
+    if (!mount_list) {
+        std::cerr << MOUNT_LIST_ERROR << argv[2] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    fbfs_options defaults;
+    set_default_options(defaults);
+
+    struct fuse_args daemon_args = FUSE_ARGS_INIT(0, NULL);
+    fuse_opt_add_arg(&daemon_args, argv[0]);
+    for (int i = 3; i < argc; ++i) {
+        fuse_opt_add_arg(&daemon_args, argv[i]);
+    }
+
+    if (fuse_opt_parse(&daemon_args, &defaults, fbfs_opts, NULL) == -1 ||
+            !check_options(defaults)) {
+        return EXIT_FAILURE;
+    }
+
+    // One token for every mount would let each owner act as its owner
+    if (defaults.token_file) {
+        std::cerr << DAEMON_TOKEN_ERROR << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::shared_ptr<Transport> transport = std::make_shared<Transport>();
+    configure_transport(*transport, defaults);
+    std::shared_ptr<PublicCache> public_cache = std::make_shared<PublicCache>();
+
+    // Signals are waited for below, so every thread started from here on
+    // must leave them to the main thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::unique_ptr<daemon_mount>> mounts;
+    std::atomic<unsigned> running(0);
+    std::string line;
+    while (std::getline(mount_list, line)) {
+        boost::algorithm::trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::unique_ptr<daemon_mount> mount(new daemon_mount());
+        std::string owner_name;
+        std::string mount_options;
+        fields >> mount->mountpoint >> owner_name >> mount_options;
+
+        struct passwd *owner = find_user(owner_name);
+        if (!owner) {
+            std::cerr << MOUNT_ERROR << mount->mountpoint << ": " << OWNER_ERROR
+                      << owner_name << std::endl;
+            continue;
+        }
+        mount->state.owner = owner->pw_uid;
+
+        struct fuse_args args = FUSE_ARGS_INIT(0, NULL);
+        for (int i = 0; i < daemon_args.argc; ++i) {
+            fuse_opt_add_arg(&args, daemon_args.argv[i]);
+        }
+        if (!mount_options.empty()) {
+            fuse_opt_add_arg(&args, ("-o" + mount_options).c_str());
+        }
+        fuse_opt_add_arg(&args, "-ointr");
+        fuse_opt_add_arg(&args, ("-oallow_other,default_permissions,uid=" +
+                                 std::to_string(owner->pw_uid) + ",gid=" +
+                                 std::to_string(owner->pw_gid)).c_str());
+
+        fbfs_options &options = mount->state.options;
+        options = defaults;
+        if (fuse_opt_parse(&args, &options, fbfs_opts, NULL) == -1 ||
+                !check_options(options)) {
+            fuse_opt_free_args(&args);
+            continue;
+        }
+        add_negative_timeout(args, options);
+
+        // The daemon can't open a browser for each account, so they must be
+        // logged in already. Logging in before mounting means that one
+        // account without a token doesn't stop the others.
+        mount->state.graph.reset(new FBGraph(transport, public_cache));
+        FBGraph &fb_graph = *mount->state.graph;
+        if (options.graph_url) {
+            fb_graph.set_graph_url(options.graph_url);
+        }
+
+        log_in_with_token(fb_graph, find_owner_token(options, owner->pw_uid));
+        if (!fb_graph.is_logged_in()) {
+            std::cerr << MOUNT_ERROR << mount->mountpoint << ": "
+                      << LOGIN_ERROR << std::endl;
+            fuse_opt_free_args(&args);
+            continue;
+        }
+
+        // Each mount needs a journal of its own
+        std::string journal_name =
+            boost::filesystem::absolute(mount->mountpoint).string();
+        std::replace(journal_name.begin(), journal_name.end(), '/', '_');
+        mount->state.journal_name = JOURNAL_FILE_NAME + journal_name;
+        if (!open_journal(mount->state)) {
+            std::cerr << MOUNT_ERROR << mount->mountpoint << std::endl;
+            fuse_opt_free_args(&args);
+            continue;
+        }
+
+        mount->channel = fuse_mount(mount->mountpoint.c_str(), &args);
+        if (!mount->channel) {
+            std::cerr << MOUNT_ERROR << mount->mountpoint << std::endl;
+            fuse_opt_free_args(&args);
+            continue;
+        }
+
+        mount->fuse = fuse_new(mount->channel, &args, &fbfs_oper,
+                               sizeof(fbfs_oper), &mount->state);
+        fuse_opt_free_args(&args);
+        if (!mount->fuse) {
+            std::cerr << MOUNT_ERROR << mount->mountpoint << std::endl;
+            fuse_unmount(mount->mountpoint.c_str(), mount->channel);
+            continue;
+        }
+
+        ++running;
+        struct fuse *fuse = mount->fuse;
+        mount->loop = std::thread([fuse, &running]() {
+            fuse_loop_mt(fuse);
+
+            // Stop once every mount has been unmounted
+            if (--running == 0) {
+                kill(getpid(), SIGTERM);
+            }
+        });
+        mounts.push_back(std::move(mount));
+    }
+    fuse_opt_free_args(&daemon_args);
+
+    if (mounts.empty()) {
+        return EXIT_FAILURE;
+    }
+
+    int received;
+    sigwait(&signals, &received);
+
+    for (auto &mount : mounts) {
+        fuse_exit(mount->fuse);
+        fuse_unmount(mount->mountpoint.c_str(), mount->channel);
+    }
+
+    for (auto &mount : mounts) {
+        mount->loop.join();
+        fuse_destroy(mount->fuse);
+    }
+
+    std::cout << public_cache->size() << " public responses were shared" << std::endl;
+    return EXIT_SUCCESS;
 }
 
 void call_fusermount() {
@@ -464,10 +1375,35 @@ void call_fusermount() {
 }
 
 int main(int argc, char *argv[]) {
+    if (argc > 1 && argv[1] == DUMP_COMMAND) {
+        return run_dump(argc, argv);
+    }
+
     umask(0);
+    initialize_operations(fbfs_oper);
+
+    if (argc > 1 && argv[1] == DAEMON_COMMAND) {
+        return run_daemon(argc, argv);
+    }
+
+    fbfs_mount mount;
+    fbfs_options &options = mount.options;
+    set_default_options(options);
+    mount.journal_name = JOURNAL_FILE_NAME;
+
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    if (fuse_opt_parse(&args, &options, fbfs_opts, NULL) == -1 ||
+            !check_options(options)) {
+        return EXIT_FAILURE;
+    }
+
+    // FUSE only forwards interrupts to the filesystem when asked to
+    fuse_opt_add_arg(&args, "-ointr");
+    add_negative_timeout(args, options);
 
     std::atexit(call_fusermount);
 
-    initialize_operations(fbfs_oper);
-    return fuse_main(argc, argv, &fbfs_oper, NULL);
+    int status = fuse_main(args.argc, args.argv, &fbfs_oper, &mount);
+    fuse_opt_free_args(&args);
+    return status;
 }
@@ -0,0 +1,260 @@
+#include "Test.h"
+#include "FBGraph.h"
+#include "LocalServer.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::vector<std::string> ids_t;
+
+// The objects of one node, newest first, as Facebook would list them
+class FakeListing {
+    public:
+        FakeListing() : failing(false) {};
+
+        void add(const std::string &id, const int64_t updated_time) {
+            std::lock_guard<std::mutex> lock(mutex);
+            objects.insert(objects.begin(), std::make_pair(id, updated_time));
+        }
+
+        void remove(const std::string &id) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto object = objects.begin(); object != objects.end(); ++object) {
+                if (object->first == id) {
+                    objects.erase(object);
+                    return;
+                }
+            }
+        }
+
+        void set_failing(const bool failing) {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->failing = failing;
+        }
+
+        // Answers with the objects updated since the given time, if any, up
+        // to the limit
+        HttpReply answer(const HttpRequest &request) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (failing) {
+                return HttpReply(503, "Service Unavailable");
+            }
+
+            boost::optional<std::string> since = request.get_parameter("since");
+            boost::optional<std::string> limit = request.get_parameter("limit");
+            std::size_t count = 0;
+            std::string data;
+            for (auto &object : objects) {
+                if (limit && count == std::stoul(limit.get())) {
+                    break;
+                } else if (since && object.second < std::stoll(since.get())) {
+                    continue;
+                }
+
+                data += std::string(count ? "," : "") + "{\"id\":\"" + object.first +
+                    "\",\"name\":\"" + object.first + "\",\"message\":\"status " +
+                    object.first + "\",\"updated_time\":" +
+                    std::to_string(object.second) + "}";
+                ++count;
+            }
+            return HttpReply(200, "{\"data\":[" + data + "]}");
+        }
+    private:
+        std::mutex mutex;
+        std::vector<std::pair<std::string, int64_t>> objects;
+        bool failing;
+};
+
+static ids_t list_statuses(FBGraph &graph) {
+    ids_t ids;
+    json_spirit::mObject response = graph.list_statuses("me", ids);
+    CHECK(!response.count("error"));
+    return ids;
+}
+
+static void wait_for_ttl() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+}
+
+static void use_server(FBGraph &graph, LocalServer &server) {
+    graph.set_graph_url(server.get_url());
+    graph.get_transport().set_max_retries(0);
+    graph.set_listing_ttl(std::chrono::seconds(1));
+    graph.set_reconcile_interval(std::chrono::seconds(3600));
+}
+
+TEST(listings_are_fetched_in_full_the_first_time) {
+    FakeListing listing;
+    listing.add("1", 100);
+    listing.add("2", 200);
+    LocalServer server([&listing](const HttpRequest &request) {
+        return listing.answer(request);
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    CHECK((list_statuses(graph) == ids_t{"2", "1"}));
+    std::vector<HttpRequest> requests = server.get_requests();
+    CHECK_EQUAL(1u, requests.size());
+    if (requests.size() == 1) {
+        CHECK_EQUAL("/me/statuses", requests[0].get_path());
+        CHECK(!requests[0].get_parameter("since"));
+    }
+
+    // A fresh listing isn't fetched again
+    CHECK((list_statuses(graph) == ids_t{"2", "1"}));
+    CHECK_EQUAL(1u, server.get_requests().size());
+}
+
+TEST(stale_listings_fetch_only_newer_objects) {
+    FakeListing listing;
+    listing.add("1", 100);
+    listing.add("2", 200);
+    LocalServer server([&listing](const HttpRequest &request) {
+        return listing.answer(request);
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    list_statuses(graph);
+    uint64_t generation = graph.get_listing_generation();
+    listing.add("3", 300);
+    listing.add("4", 400);
+    wait_for_ttl();
+
+    // The newest status already known comes back too, but isn't listed twice
+    CHECK((list_statuses(graph) == ids_t{"4", "3", "2", "1"}));
+    CHECK(graph.get_listing_generation() != generation);
+
+    std::vector<HttpRequest> requests = server.get_requests();
+    CHECK_EQUAL(2u, requests.size());
+    if (requests.size() == 2) {
+        CHECK(requests[1].get_parameter("since") == std::string("200"));
+        CHECK(requests[1].get_parameter("limit") == std::string("25"));
+    }
+
+    // The next sync starts from the newest status seen
+    wait_for_ttl();
+    list_statuses(graph);
+    requests = server.get_requests();
+    CHECK_EQUAL(3u, requests.size());
+    if (requests.size() == 3) {
+        CHECK(requests[2].get_parameter("since") == std::string("400"));
+    }
+}
+
+TEST(full_pages_replace_the_listing) {
+    FakeListing listing;
+    listing.add("old", 100);
+    LocalServer server([&listing](const HttpRequest &request) {
+        return listing.answer(request);
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    list_statuses(graph);
+    ids_t newest;
+    for (int i = 0; i < 30; ++i) {
+        listing.add(std::to_string(i), 200 + i);
+    }
+    for (int i = 29; i >= 5; --i) {
+        newest.push_back(std::to_string(i));
+    }
+    wait_for_ttl();
+
+    // More changed than fits in a page, so what lies between the page and
+    // the cached listing is unknown
+    CHECK(list_statuses(graph) == newest);
+}
+
+TEST(reconciling_notices_deleted_objects) {
+    FakeListing listing;
+    listing.add("1", 100);
+    listing.add("2", 200);
+    listing.add("3", 300);
+    LocalServer server([&listing](const HttpRequest &request) {
+        return listing.answer(request);
+    });
+    FBGraph graph;
+    use_server(graph, server);
+    graph.set_reconcile_interval(std::chrono::seconds(1));
+
+    list_statuses(graph);
+    listing.remove("2");
+    wait_for_ttl();
+
+    CHECK((list_statuses(graph) == ids_t{"3", "1"}));
+    std::vector<HttpRequest> requests = server.get_requests();
+    CHECK_EQUAL(2u, requests.size());
+    if (requests.size() == 2) {
+        CHECK(!requests[1].get_parameter("since"));
+    }
+}
+
+TEST(incremental_syncs_miss_deleted_objects) {
+    FakeListing listing;
+    listing.add("1", 100);
+    listing.add("2", 200);
+    LocalServer server([&listing](const HttpRequest &request) {
+        return listing.answer(request);
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    list_statuses(graph);
+    listing.remove("1");
+    wait_for_ttl();
+
+    // Until the next full sync
+    CHECK((list_statuses(graph) == ids_t{"2", "1"}));
+}
+
+TEST(stale_listings_are_used_when_facebook_is_unreachable) {
+    FakeListing listing;
+    listing.add("1", 100);
+    LocalServer server([&listing](const HttpRequest &request) {
+        return listing.answer(request);
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    list_statuses(graph);
+    listing.set_failing(true);
+    wait_for_ttl();
+    CHECK((list_statuses(graph) == ids_t{"1"}));
+
+    // Clearing the cache asks for an up to date listing, which fails
+    ids_t ids;
+    CHECK(graph.list_statuses("me", ids, true).count("error"));
+}
+
+TEST(album_listings_are_synced_the_same_way) {
+    FakeListing listing;
+    listing.add("Holidays", 100);
+    LocalServer server([&listing](const HttpRequest &request) {
+        return listing.answer(request);
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    ids_t names;
+    CHECK(!graph.list_albums("me", names).count("error"));
+    CHECK((names == ids_t{"Holidays"}));
+
+    listing.add("Work", 200);
+    wait_for_ttl();
+    names.clear();
+    CHECK(!graph.list_albums("me", names).count("error"));
+    CHECK((names == ids_t{"Work", "Holidays"}));
+
+    std::vector<HttpRequest> requests = server.get_requests();
+    CHECK_EQUAL(2u, requests.size());
+    if (requests.size() == 2) {
+        CHECK_EQUAL("/me/albums", requests[1].get_path());
+        CHECK(requests[1].get_parameter("since") == std::string("100"));
+    }
+}
@@ -0,0 +1,431 @@
+#include "Test.h"
+#include "FBGraph.h"
+#include "Journal.h"
+#include "LocalServer.h"
+
+#include <boost/filesystem.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const std::string USER_ID = "42";
+
+// A journal file that is removed when the test ends
+class TemporaryJournal {
+    public:
+        TemporaryJournal() : path(boost::filesystem::unique_path(
+            boost::filesystem::temp_directory_path() / "fbfs-journal-%%%%-%%%%").string()) {};
+        ~TemporaryJournal() {
+            boost::filesystem::remove(path);
+        }
+
+        void write(const std::string &contents) const {
+            std::ofstream file(path, std::ios::binary);
+            file << contents;
+        }
+
+        std::string read() const {
+            std::ifstream file(path, std::ios::binary);
+            std::ostringstream contents;
+            contents << file.rdbuf();
+            return contents.str();
+        }
+
+        std::string path;
+};
+
+// Stands in for the parts of Facebook that the journal uses
+static HttpReply answer(const HttpRequest &request, const std::string &statuses) {
+    if (request.method == "POST") {
+        return HttpReply(200, "{\"id\":\"" + USER_ID + "_7\"}");
+    } else if (request.method == "DELETE") {
+        return HttpReply(200, "true");
+    } else if (request.get_path() == "/me/statuses") {
+        return HttpReply(200, "{\"data\":[" + statuses + "]}");
+    }
+    return HttpReply(200, "{\"id\":\"" + USER_ID + "\"}");
+}
+
+static HttpReply unavailable(const HttpRequest&) {
+    return HttpReply(503, "Service Unavailable");
+}
+
+static std::vector<HttpRequest> find_requests(LocalServer &server, const std::string &method) {
+    std::vector<HttpRequest> found;
+    for (auto &request : server.get_requests()) {
+        if (request.method == method) {
+            found.push_back(request);
+        }
+    }
+    return found;
+}
+
+static bool wait_for(const std::function<bool()> condition) {
+    auto give_up_at = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!condition()) {
+        if (std::chrono::steady_clock::now() >= give_up_at) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return true;
+}
+
+static void use_server(FBGraph &graph, LocalServer &server) {
+    graph.set_graph_url(server.get_url());
+    graph.get_transport().set_max_retries(0);
+}
+
+TEST(replay_keeps_unfinished_entries) {
+    LocalServer server(unavailable);
+    FBGraph graph;
+    use_server(graph, server);
+
+    // The last record was cut short by a crash
+    TemporaryJournal file;
+    file.write("post 1 1000 first\n"
+               "post 2 1000 second\\nline with a \\\\\n"
+               "done 1\n"
+               "delete 3 1000 12345\n"
+               "post");
+
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+
+    std::vector<JournalEntry> posts = journal.get_pending_posts();
+    CHECK_EQUAL(1u, posts.size());
+    if (posts.size() == 1) {
+        CHECK_EQUAL(2u, posts[0].sequence);
+        CHECK_EQUAL(1000, posts[0].time);
+        CHECK_EQUAL("second\nline with a \\", posts[0].argument);
+        CHECK_EQUAL("pending-2", posts[0].get_pending_name());
+    }
+    CHECK(journal.find_pending_post("pending-2"));
+    CHECK(!journal.find_pending_post("pending-1"));
+    CHECK(journal.is_pending_delete("12345"));
+    CHECK(!journal.is_pending_delete("1"));
+}
+
+TEST(replay_compacts_the_journal) {
+    LocalServer server(unavailable);
+    FBGraph graph;
+    use_server(graph, server);
+
+    TemporaryJournal file;
+    file.write("post 1 1000 first\n"
+               "post 2 1000 second\\nline\n"
+               "done 1\n"
+               "delete 3 1000 12345\n"
+               "post");
+
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK_EQUAL("post 2 1000 second\\nline\n"
+                "delete 3 1000 12345\n", file.read());
+
+    // New entries follow the highest sequence seen, finished or not
+    CHECK(journal.post("third"));
+    std::vector<JournalEntry> posts = journal.get_pending_posts();
+    CHECK_EQUAL(2u, posts.size());
+    CHECK_EQUAL("pending-4", posts.back().get_pending_name());
+    CHECK(file.read().find("post 4 ") != std::string::npos);
+    journal.stop();
+
+    // Whatever wasn't applied is there for the next mount
+    Journal reopened(graph, file.path);
+    CHECK(reopened.open());
+    posts = reopened.get_pending_posts();
+    CHECK_EQUAL(2u, posts.size());
+    CHECK_EQUAL("third", posts.back().argument);
+    CHECK(reopened.is_pending_delete("12345"));
+}
+
+TEST(replay_ignores_records_torn_inside_the_message) {
+    LocalServer server(unavailable);
+    FBGraph graph;
+    use_server(graph, server);
+
+    // Everything but the end of the message and the newline made it to disk
+    TemporaryJournal file;
+    file.write("post 1 1000 first\n"
+               "post 2 1700000000 hel");
+
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    std::vector<JournalEntry> posts = journal.get_pending_posts();
+    CHECK_EQUAL(1u, posts.size());
+    if (posts.size() == 1) {
+        CHECK_EQUAL("first", posts[0].argument);
+    }
+    CHECK_EQUAL("post 1 1000 first\n", file.read());
+}
+
+TEST(replay_ignores_records_padded_with_zeros) {
+    LocalServer server(unavailable);
+    FBGraph graph;
+    use_server(graph, server);
+
+    // After a power loss the file may be longer than what was written
+    TemporaryJournal file;
+    file.write(std::string("delete 1 1000 555\n"
+                           "post 2 1700000000 hel") + std::string(64, '\0'));
+
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(journal.get_pending_posts().empty());
+    CHECK(journal.is_pending_delete("555"));
+    CHECK_EQUAL("delete 1 1000 555\n", file.read());
+
+    // The torn record's sequence was never handed out
+    CHECK(journal.post("again"));
+    CHECK(journal.find_pending_post("pending-2"));
+}
+
+TEST(applied_entries_are_compacted_away) {
+    LocalServer server([](const HttpRequest &request) {
+        return answer(request, "");
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    TemporaryJournal file;
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(journal.post("hello"));
+    CHECK(journal.remove("555"));
+    CHECK(wait_for([&journal]() {
+        return journal.get_pending_posts().empty() && !journal.is_pending_delete("555");
+    }));
+    journal.stop();
+
+    std::vector<HttpRequest> posts = find_requests(server, "POST");
+    CHECK_EQUAL(1u, posts.size());
+    if (posts.size() == 1) {
+        CHECK_EQUAL("/me/feed", posts[0].get_path());
+        CHECK(posts[0].get_parameter("message") == std::string("hello"));
+    }
+
+    // Deletions name the status by the user and status IDs
+    std::vector<HttpRequest> deletes = find_requests(server, "DELETE");
+    CHECK_EQUAL(1u, deletes.size());
+    if (deletes.size() == 1) {
+        CHECK_EQUAL("/" + USER_ID + "_555", deletes[0].get_path());
+    }
+
+    std::string contents = file.read();
+    CHECK(contents.find("done 1\n") != std::string::npos);
+    CHECK(contents.find("done 2\n") != std::string::npos);
+
+    Journal reopened(graph, file.path);
+    CHECK(reopened.open());
+    CHECK(reopened.get_pending_posts().empty());
+    CHECK_EQUAL("", file.read());
+}
+
+TEST(replayed_posts_already_on_facebook_are_not_sent_again) {
+    LocalServer server([](const HttpRequest &request) {
+        return answer(request, "{\"id\":\"" + USER_ID + "_9\",\"message\":\"hello\"}");
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    time_t posted_at = std::time(NULL);
+    TemporaryJournal file;
+    file.write("post 1 " + std::to_string(posted_at) + " hello\n");
+
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(wait_for([&journal]() { return journal.get_pending_posts().empty(); }));
+    journal.stop();
+
+    CHECK(find_requests(server, "POST").empty());
+
+    // The clocks may disagree, so the search starts a while before the post
+    std::vector<HttpRequest> searches = find_requests(server, "GET");
+    CHECK(!searches.empty());
+    if (!searches.empty()) {
+        CHECK_EQUAL("/me/statuses", searches[0].get_path());
+        CHECK(searches[0].get_parameter("since") == std::to_string(posted_at - 600));
+    }
+    CHECK_EQUAL("post 1 " + std::to_string(posted_at) + " hello\ndone 1\n", file.read());
+}
+
+TEST(replayed_posts_missing_from_facebook_are_sent) {
+    LocalServer server([](const HttpRequest &request) {
+        return answer(request, "{\"id\":\"" + USER_ID + "_9\",\"message\":\"other\"}");
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    TemporaryJournal file;
+    file.write("post 1 " + std::to_string(std::time(NULL)) + " hello\n");
+
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(wait_for([&journal]() { return journal.get_pending_posts().empty(); }));
+    journal.stop();
+
+    std::vector<HttpRequest> posts = find_requests(server, "POST");
+    CHECK_EQUAL(1u, posts.size());
+    if (posts.size() == 1) {
+        CHECK(posts[0].get_parameter("message") == std::string("hello"));
+    }
+}
+
+TEST(pending_posts_can_be_cancelled_until_sent) {
+    // Looking up the user for the deletion keeps the worker busy
+    LocalServer server([](const HttpRequest &request) {
+        if (request.get_path() == "/me") {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+        }
+        return answer(request, "");
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    TemporaryJournal file;
+    file.write("delete 1 1000 555\n"
+               "post 2 1000 replayed\n");
+
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(journal.post("oops"));
+
+    // A replayed post may have reached Facebook before fbfs died
+    CHECK(!journal.cancel("pending-2"));
+    CHECK(journal.cancel("pending-3"));
+    CHECK(!journal.cancel("pending-3"));
+    CHECK(file.read().find("done 3\n") != std::string::npos);
+
+    CHECK(wait_for([&journal]() { return journal.get_pending_posts().empty(); }));
+    journal.stop();
+
+    std::vector<HttpRequest> posts = find_requests(server, "POST");
+    CHECK_EQUAL(1u, posts.size());
+    if (posts.size() == 1) {
+        CHECK(posts[0].get_parameter("message") == std::string("replayed"));
+    }
+}
+
+TEST(entries_stay_pending_while_facebook_is_unreachable) {
+    LocalServer server(unavailable);
+    FBGraph graph;
+    use_server(graph, server);
+
+    TemporaryJournal file;
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(journal.post("hello"));
+    CHECK(wait_for([&server]() { return !find_requests(server, "POST").empty(); }));
+    journal.stop();
+
+    // Without a response the post may have been created, so it stays in the
+    // journal and can no longer be withdrawn
+    CHECK(file.read().find("done") == std::string::npos);
+    Journal reopened(graph, file.path);
+    CHECK(reopened.open());
+    CHECK_EQUAL(1u, reopened.get_pending_posts().size());
+    CHECK(!reopened.cancel("pending-1"));
+}
+
+static std::string make_error(const int code, const std::string &message) {
+    return "{\"error\":{\"message\":\"" + message +
+        "\",\"type\":\"OAuthException\",\"code\":" + std::to_string(code) + "}}";
+}
+
+TEST(throttled_entries_are_retried) {
+    std::atomic<int> posts(0);
+    LocalServer server([&posts](const HttpRequest &request) {
+        if (request.method == "POST" && ++posts == 1) {
+            return HttpReply(400, make_error(17, "User request limit reached"));
+        }
+        return answer(request, "");
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    TemporaryJournal file;
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(journal.post("hello"));
+    CHECK(wait_for([&journal]() { return journal.get_pending_posts().empty(); }));
+    journal.stop();
+
+    CHECK_EQUAL(2, posts.load());
+    CHECK(file.read().find("done 1\n") != std::string::npos);
+}
+
+TEST(entries_wait_for_a_new_token) {
+    LocalServer server([](const HttpRequest &request) {
+        if (request.method == "POST") {
+            return HttpReply(400, make_error(190, "Error validating access token"));
+        }
+        return answer(request, "");
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    TemporaryJournal file;
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(journal.post("hello"));
+    CHECK(wait_for([&server]() { return !find_requests(server, "POST").empty(); }));
+    journal.stop();
+
+    CHECK_EQUAL(1u, journal.get_pending_posts().size());
+    CHECK(file.read().find("done") == std::string::npos);
+
+    // It is still there for the next mount, in case the token is renewed
+    Journal reopened(graph, file.path);
+    CHECK(reopened.open());
+    CHECK_EQUAL(1u, reopened.get_pending_posts().size());
+}
+
+TEST(server_errors_keep_entries_pending) {
+    LocalServer server([](const HttpRequest &request) {
+        if (request.method == "DELETE") {
+            return HttpReply(500, make_error(1, "An unknown error occurred"));
+        }
+        return answer(request, "");
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    TemporaryJournal file;
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(journal.remove("555"));
+    CHECK(wait_for([&server]() { return !find_requests(server, "DELETE").empty(); }));
+    journal.stop();
+
+    CHECK(journal.is_pending_delete("555"));
+    CHECK(file.read().find("done") == std::string::npos);
+}
+
+TEST(refused_entries_are_dropped) {
+    LocalServer server([](const HttpRequest &request) {
+        if (request.method == "POST") {
+            return HttpReply(400, make_error(100, "Invalid parameter"));
+        }
+        return answer(request, "");
+    });
+    FBGraph graph;
+    use_server(graph, server);
+
+    TemporaryJournal file;
+    Journal journal(graph, file.path);
+    CHECK(journal.open());
+    CHECK(journal.post("hello"));
+    CHECK(wait_for([&journal]() { return journal.get_pending_posts().empty(); }));
+    journal.stop();
+
+    CHECK_EQUAL(1u, find_requests(server, "POST").size());
+    CHECK(file.read().find("done 1\n") != std::string::npos);
+}
@@ -0,0 +1,244 @@
+#include "LocalServer.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+#include <stdexcept>
+
+static const std::string HEADER_END = "\r\n\r\n";
+static const std::string LINE_END = "\r\n";
+
+static std::string to_lower(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+    return value;
+}
+
+static std::string decode(const std::string &value) {
+    std::string decoded;
+    for (std::size_t i = 0; i < value.length(); ++i) {
+        if (value[i] == '%' && i + 2 < value.length()) {
+            decoded += static_cast<char>(std::strtol(value.substr(i + 1, 2).c_str(), NULL, 16));
+            i += 2;
+        } else if (value[i] == '+') {
+            decoded += ' ';
+        } else {
+            decoded += value[i];
+        }
+    }
+    return decoded;
+}
+
+std::string HttpRequest::get_path() const {
+    return target.substr(0, target.find('?'));
+}
+
+boost::optional<std::string> HttpRequest::get_parameter(const std::string &name) const {
+    std::size_t query_start = target.find('?');
+    if (query_start == std::string::npos) {
+        return boost::optional<std::string>();
+    }
+
+    std::istringstream query(target.substr(query_start + 1));
+    std::string pair;
+    while (std::getline(query, pair, '&')) {
+        std::size_t separator = pair.find('=');
+        if (decode(pair.substr(0, separator)) == name) {
+            return boost::optional<std::string>(separator == std::string::npos ?
+                "" : decode(pair.substr(separator + 1)));
+        }
+    }
+
+    return boost::optional<std::string>();
+}
+
+HttpReply::HttpReply(const long status, const std::string &body) :
+    status(status), body(body) {};
+
+LocalServer::LocalServer(const handler_t handler) :
+    handler(handler), port(0), stopping(false) {
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd == -1) {
+        throw std::runtime_error("Could not create a socket");
+    }
+
+    // Let the kernel pick a free port
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    if (bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listen_fd, 64) != 0 ||
+            getsockname(listen_fd, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+        close(listen_fd);
+        throw std::runtime_error("Could not listen on the loopback interface");
+    }
+    port = ntohs(address.sin_port);
+
+    acceptor = std::thread(&LocalServer::accept_connections, this);
+}
+
+LocalServer::~LocalServer() {
+    stopping = true;
+    shutdown(listen_fd, SHUT_RDWR);
+    acceptor.join();
+    close(listen_fd);
+
+    // Handlers that are still running finish, but their replies go nowhere
+    std::vector<std::thread> remaining;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int fd : connections) {
+            shutdown(fd, SHUT_RDWR);
+        }
+        remaining.swap(workers);
+    }
+
+    for (auto &worker : remaining) {
+        worker.join();
+    }
+}
+
+std::string LocalServer::get_url() const {
+    return "http://127.0.0.1:" + std::to_string(port);
+}
+
+std::vector<HttpRequest> LocalServer::get_requests() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return requests;
+}
+
+void LocalServer::accept_connections() {
+    while (!stopping) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd == -1) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping) {
+            close(fd);
+            return;
+        }
+        connections.push_back(fd);
+        workers.push_back(std::thread(&LocalServer::serve, this, fd));
+    }
+}
+
+// Answers requests on a connection until the client closes it
+void LocalServer::serve(const int fd) {
+    std::string received;
+    HttpRequest request;
+    while (read_request(fd, received, request)) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            requests.push_back(request);
+        }
+
+        HttpReply reply = handler(request);
+        std::ostringstream response;
+        response << "HTTP/1.1 " << reply.status << " Status" << LINE_END
+                 << "Content-Type: application/json" << LINE_END
+                 << "Content-Length: " << reply.body.size() << HEADER_END
+                 << reply.body;
+
+        std::string data = response.str();
+        if (send(fd, data.data(), data.size(), MSG_NOSIGNAL) !=
+                static_cast<ssize_t>(data.size())) {
+            break;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    connections.erase(std::find(connections.begin(), connections.end(), fd));
+    close(fd);
+}
+
+// Reads until the buffer holds what is asked for. Returns false if the
+// connection closed first.
+static bool fill(const int fd, std::string &received, const std::size_t size) {
+    char chunk[4096];
+    while (received.size() < size) {
+        ssize_t count = recv(fd, chunk, sizeof(chunk), 0);
+        if (count <= 0) {
+            return false;
+        }
+        received.append(chunk, count);
+    }
+    return true;
+}
+
+static bool fill_until(const int fd, std::string &received,
+                       const std::string &delimiter, std::size_t &position) {
+    while ((position = received.find(delimiter)) == std::string::npos) {
+        if (!fill(fd, received, received.size() + 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool LocalServer::read_request(const int fd, std::string &received,
+                               HttpRequest &request) {
+    std::size_t header_end;
+    if (!fill_until(fd, received, HEADER_END, header_end)) {
+        return false;
+    }
+
+    request = HttpRequest();
+    std::istringstream head(received.substr(0, header_end));
+    received.erase(0, header_end + HEADER_END.size());
+
+    std::string line;
+    std::getline(head, line);
+    std::istringstream request_line(line);
+    request_line >> request.method >> request.target;
+
+    while (std::getline(head, line)) {
+        std::size_t separator = line.find(':');
+        if (separator == std::string::npos) {
+            continue;
+        }
+
+        std::string value = line.substr(separator + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        value.erase(value.find_last_not_of("\r ") + 1);
+        request.headers[to_lower(line.substr(0, separator))] = value;
+    }
+
+    if (to_lower(request.headers["transfer-encoding"]) == "chunked") {
+        while (true) {
+            std::size_t size_end;
+            if (!fill_until(fd, received, LINE_END, size_end)) {
+                return false;
+            }
+
+            std::size_t size = std::strtoul(received.c_str(), NULL, 16);
+            received.erase(0, size_end + LINE_END.size());
+            if (!fill(fd, received, size + LINE_END.size())) {
+                return false;
+            }
+
+            request.body.append(received, 0, size);
+            received.erase(0, size + LINE_END.size());
+            if (size == 0) {
+                return true;
+            }
+        }
+    }
+
+    std::size_t length = std::strtoul(request.headers["content-length"].c_str(), NULL, 10);
+    if (!fill(fd, received, length)) {
+        return false;
+    }
+
+    request.body = received.substr(0, length);
+    received.erase(0, length);
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef LOCALSERVER_H
+#define LOCALSERVER_H
+
+#include <boost/optional.hpp>
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class HttpRequest {
+    public:
+        std::string get_path() const;
+        boost::optional<std::string> get_parameter(const std::string&) const;
+
+        std::string method;
+
+        // The path along with the query string
+        std::string target;
+        std::map<std::string, std::string> headers;
+        std::string body;
+};
+
+class HttpReply {
+    public:
+        HttpReply(const long = 200, const std::string& = "{}");
+
+        long status;
+        std::string body;
+};
+
+// An HTTP server on the loopback interface that stands in for Facebook. Each
+// connection is served on its own thread, so the handler may block (to make a
+// request slow, for example) and must be safe to call concurrently.
+class LocalServer {
+    public:
+        typedef std::function<HttpReply(const HttpRequest&)> handler_t;
+
+        explicit LocalServer(const handler_t);
+        ~LocalServer();
+        std::string get_url() const;
+        std::vector<HttpRequest> get_requests();
+    private:
+        void accept_connections();
+        void serve(const int);
+        bool read_request(const int, std::string&, HttpRequest&);
+
+        handler_t handler;
+        int listen_fd;
+        int port;
+        std::atomic<bool> stopping;
+        std::thread acceptor;
+
+        std::mutex mutex;
+        std::vector<int> connections;
+        std::vector<std::thread> workers;
+        std::vector<HttpRequest> requests;
+};
+
+#endif // LOCALSERVER_H
@@ -0,0 +1,73 @@
+#include "Test.h"
+#include "NegativeCache.h"
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+TEST(remembers_missing_paths) {
+    NegativeCache cache;
+    CHECK(!cache.contains("/statuses/.hidden"));
+
+    cache.add("/statuses/.hidden");
+    CHECK(cache.contains("/statuses/.hidden"));
+    CHECK(!cache.contains("/statuses/.git"));
+}
+
+TEST(forgets_paths_after_the_ttl) {
+    NegativeCache cache;
+    cache.set_ttl(std::chrono::milliseconds(50));
+    cache.add("/statuses/.hidden");
+    CHECK(cache.contains("/statuses/.hidden"));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(!cache.contains("/statuses/.hidden"));
+}
+
+TEST(remembers_nothing_without_a_ttl) {
+    NegativeCache cache;
+    cache.set_ttl(std::chrono::milliseconds::zero());
+    cache.add("/statuses/.hidden");
+    CHECK(!cache.contains("/statuses/.hidden"));
+
+    // Options reject negative TTLs, but they mustn't cache anything either
+    cache.set_ttl(std::chrono::milliseconds(-1000));
+    cache.add("/statuses/.hidden");
+    CHECK(!cache.contains("/statuses/.hidden"));
+}
+
+TEST(clear_forgets_every_path) {
+    NegativeCache cache;
+    cache.add("/statuses/.hidden");
+    cache.add("/albums/.git");
+    cache.clear();
+    CHECK(!cache.contains("/statuses/.hidden"));
+    CHECK(!cache.contains("/albums/.git"));
+}
+
+TEST(new_generations_forget_every_path) {
+    NegativeCache cache;
+    cache.set_generation(1);
+    cache.add("/statuses/.hidden");
+
+    // The same generation keeps what is known
+    cache.set_generation(1);
+    CHECK(cache.contains("/statuses/.hidden"));
+
+    cache.set_generation(2);
+    CHECK(!cache.contains("/statuses/.hidden"));
+
+    cache.add("/statuses/.hidden");
+    CHECK(cache.contains("/statuses/.hidden"));
+}
+
+TEST(stays_bounded_when_full_of_fresh_paths) {
+    NegativeCache cache;
+    for (int i = 0; i < 10000; ++i) {
+        cache.add("/statuses/missing-" + std::to_string(i));
+    }
+
+    // Older paths may have been dropped, but the newest is always kept
+    CHECK(cache.contains("/statuses/missing-9999"));
+    CHECK(!cache.contains("/statuses/missing-0"));
+}
@@ -0,0 +1,127 @@
+#include "Test.h"
+#include "SearchIndex.h"
+#include "Store.h"
+
+#include <string>
+#include <vector>
+
+typedef std::vector<PostingList::row_t> rows_t;
+
+TEST(posting_list_round_trips_any_gap) {
+    // Gaps on either side of each varint byte boundary
+    rows_t rows{0, 1, 128, 255, 16639, 16640, 2113792, 270549119, 0xffffffffu};
+    PostingList list;
+    for (auto row : rows) {
+        list.add(row);
+    }
+
+    CHECK(list.get() == rows);
+    CHECK_EQUAL(rows.size(), list.size());
+}
+
+TEST(posting_list_stores_close_rows_in_a_byte) {
+    PostingList list;
+    rows_t rows;
+    for (PostingList::row_t row = 1000; row < 11000; row += 3) {
+        list.add(row);
+        rows.push_back(row);
+    }
+
+    // Even with the vector's spare capacity, that's less than the rows
+    // themselves would take
+    CHECK(list.get() == rows);
+    CHECK(list.memory_usage() < rows.size() * sizeof(PostingList::row_t));
+}
+
+TEST(posting_list_sorts_rows_added_out_of_order) {
+    PostingList list;
+    list.add(10);
+    list.add(20);
+    list.add(5);
+    list.add(20);
+    list.add(15);
+    list.add(5);
+
+    CHECK((list.get() == rows_t{5, 10, 15, 20}));
+}
+
+TEST(posting_list_merges_rows_added_out_of_order) {
+    // Enough rows out of order to be merged several times
+    PostingList list;
+    list.add(100);
+    rows_t rows{100};
+    for (PostingList::row_t row = 100; row-- > 0;) {
+        list.add(row);
+        rows.insert(rows.begin(), row);
+    }
+
+    CHECK(list.get() == rows);
+    CHECK_EQUAL(rows.size(), list.size());
+
+    // Later rows still go after the merged ones
+    list.add(200);
+    rows.push_back(200);
+    CHECK(list.get() == rows);
+}
+
+TEST(tokenize_splits_words_without_case) {
+    std::vector<std::string> words = SearchIndex::tokenize("Hello, World! It's 2014...");
+    CHECK((words == std::vector<std::string>{"hello", "world", "it", "s", "2014"}));
+    CHECK(SearchIndex::tokenize("").empty());
+    CHECK(SearchIndex::tokenize(" -- ").empty());
+
+    // Bytes outside of ASCII are part of words
+    CHECK((SearchIndex::tokenize("Caf\xc3\xa9 au lait") ==
+           std::vector<std::string>{"caf\xc3\xa9", "au", "lait"}));
+}
+
+TEST(matches_requires_every_word) {
+    CHECK(SearchIndex::matches("Off to the beach today", "BEACH today"));
+    CHECK(SearchIndex::matches("Off to the beach today", "today beach"));
+    CHECK(!SearchIndex::matches("Off to the beach today", "beach tomorrow"));
+    CHECK(!SearchIndex::matches("Off to the beaches", "beach"));
+}
+
+TEST(search_intersects_words) {
+    StringArena arena;
+    SearchIndex index(arena);
+    index.add(0, "Off to the beach");
+    index.add(1, "Rain at the beach again");
+    index.add(2, "Rain all day");
+    index.add(3, "beach beach beach");
+
+    CHECK((index.search("beach") == rows_t{0, 1, 3}));
+    CHECK((index.search("the Beach") == rows_t{0, 1}));
+    CHECK((index.search("rain") == rows_t{1, 2}));
+    CHECK((index.search("rain beach") == rows_t{1}));
+    CHECK(index.search("snow").empty());
+    CHECK(index.search("rain snow").empty());
+    CHECK(index.search("").empty());
+}
+
+TEST(search_returns_rows_in_order) {
+    StringArena arena;
+    SearchIndex index(arena);
+
+    // Edited statuses are indexed again, out of order
+    for (SearchIndex::row_t row = 0; row < 50; ++row) {
+        index.add(row, row % 2 ? "odd word" : "even word");
+    }
+    for (SearchIndex::row_t row = 50; row-- > 0;) {
+        index.add(row, "word edited");
+    }
+
+    rows_t all;
+    rows_t odd;
+    for (SearchIndex::row_t row = 0; row < 50; ++row) {
+        all.push_back(row);
+        if (row % 2) {
+            odd.push_back(row);
+        }
+    }
+
+    CHECK(index.search("word") == all);
+    CHECK(index.search("edited") == all);
+    CHECK(index.search("odd edited") == odd);
+    CHECK_EQUAL(4u, index.size());
+}
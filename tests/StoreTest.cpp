@@ -0,0 +1,206 @@
+#include "Test.h"
+#include "Store.h"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+TEST(arena_stores_strings_of_any_length) {
+    StringArena arena;
+    std::string empty;
+    std::string long_string(100000, 'x');
+    StringArena::handle_t empty_handle = arena.add(empty);
+    StringArena::handle_t long_handle = arena.add(long_string);
+    StringArena::handle_t short_handle = arena.add("status");
+
+    CHECK_EQUAL(empty, arena.get(empty_handle));
+    CHECK_EQUAL(long_string, arena.get(long_handle));
+    CHECK_EQUAL(100000u, arena.length(long_handle));
+    CHECK_EQUAL("status", arena.get(short_handle));
+    CHECK(arena.equals(short_handle, "status"));
+    CHECK(!arena.equals(short_handle, "statuses"));
+}
+
+TEST(arena_interns_equal_strings_once) {
+    StringArena arena;
+    StringArena::handle_t first = arena.intern("10150145806225128");
+    CHECK(arena.intern("10150145806225128") == first);
+    CHECK(arena.intern("10150145806225129") != first);
+    CHECK(arena.find("10150145806225128") == first);
+    CHECK(!arena.find("missing"));
+
+    // Added strings aren't interned
+    arena.add("added");
+    CHECK(!arena.find("added"));
+}
+
+TEST(arena_finds_interned_strings_after_growing) {
+    StringArena arena;
+    std::vector<StringArena::handle_t> handles;
+    for (int i = 0; i < 1000; ++i) {
+        handles.push_back(arena.intern("id" + std::to_string(i)));
+    }
+
+    for (int i = 0; i < 1000; ++i) {
+        CHECK(arena.find("id" + std::to_string(i)) == handles[i]);
+        CHECK_EQUAL("id" + std::to_string(i), arena.get(handles[i]));
+    }
+}
+
+TEST(arena_copies_ranges) {
+    StringArena arena;
+    StringArena::handle_t handle = arena.add("hello world");
+    char buffer[16];
+
+    CHECK_EQUAL(5u, arena.copy(handle, buffer, 5, 6));
+    CHECK_EQUAL("world", std::string(buffer, 5));
+
+    // Reads past the end are cut short
+    CHECK_EQUAL(3u, arena.copy(handle, buffer, sizeof(buffer), 8));
+    CHECK_EQUAL("rld", std::string(buffer, 3));
+    CHECK_EQUAL(0u, arena.copy(handle, buffer, sizeof(buffer), 11));
+}
+
+TEST(table_finds_rows_by_key) {
+    StringArena arena;
+    StatusTable statuses(arena);
+    std::vector<Table::row_t> rows;
+    for (int i = 0; i < 500; ++i) {
+        rows.push_back(statuses.put("status" + std::to_string(i), i,
+                                    "message " + std::to_string(i)));
+    }
+
+    CHECK_EQUAL(500u, statuses.size());
+    for (int i = 0; i < 500; ++i) {
+        std::string key = "status" + std::to_string(i);
+        CHECK(statuses.find(key) == rows[i]);
+        CHECK_EQUAL(key, statuses.get_key(rows[i]));
+        CHECK_EQUAL("message " + std::to_string(i), statuses.get_message(rows[i]));
+        CHECK_EQUAL(i, statuses.get_updated_time(rows[i]));
+    }
+    CHECK(!statuses.find("status500"));
+}
+
+TEST(putting_a_status_again_updates_its_row) {
+    StringArena arena;
+    StatusTable statuses(arena);
+    Table::row_t row = statuses.put("1", 100, "first");
+    uint32_t version = statuses.get_version(row);
+
+    // An unchanged message keeps its version
+    CHECK_EQUAL(row, statuses.put("1", 200, "first"));
+    CHECK_EQUAL(version, statuses.get_version(row));
+    CHECK_EQUAL(200, statuses.get_updated_time(row));
+
+    CHECK_EQUAL(row, statuses.put("1", 300, "edited"));
+    CHECK(statuses.get_version(row) != version);
+    CHECK_EQUAL("edited", statuses.get_message(row));
+    CHECK_EQUAL(6u, statuses.get_message_length(row));
+    CHECK_EQUAL(1u, statuses.size());
+}
+
+TEST(removed_rows_disappear_until_put_again) {
+    StringArena arena;
+    StatusTable statuses(arena);
+    Table::row_t first = statuses.put("1", 100, "first");
+    Table::row_t second = statuses.put("2", 200, "second");
+    statuses.set_listing("me", std::vector<Table::row_t>{second, first});
+
+    statuses.remove("1");
+    CHECK(!statuses.find("1"));
+    CHECK(statuses.get_listing("me") == std::vector<Table::row_t>{second});
+
+    statuses.put("1", 100, "first");
+    CHECK(statuses.find("1") == first);
+    CHECK((statuses.get_listing("me") == std::vector<Table::row_t>{second, first}));
+}
+
+TEST(listings_are_kept_per_node) {
+    StringArena arena;
+    StatusTable statuses(arena);
+    Table::row_t first = statuses.put("1", 100, "first");
+    Table::row_t second = statuses.put("2", 200, "second");
+
+    CHECK(!statuses.has_listing("me"));
+    CHECK(statuses.get_listing("me").empty());
+
+    statuses.set_listing("me", std::vector<Table::row_t>{first});
+    statuses.set_listing("friend", std::vector<Table::row_t>());
+    CHECK(statuses.has_listing("me"));
+    CHECK(statuses.has_listing("friend"));
+
+    // Newer rows go first, and only once
+    statuses.prepend_to_listing("me", second);
+    statuses.prepend_to_listing("me", second);
+    CHECK((statuses.get_listing("me") == std::vector<Table::row_t>{second, first}));
+
+    // Listings that were never loaded stay that way
+    statuses.prepend_to_listing("other", second);
+    CHECK(!statuses.has_listing("other"));
+
+    statuses.remove_listing("me");
+    CHECK(!statuses.has_listing("me"));
+    CHECK(statuses.has_listing("friend"));
+}
+
+TEST(friends_are_found_by_name) {
+    StringArena arena;
+    FriendTable friends(arena);
+    Table::row_t alice = friends.put("100", "Alice Example");
+    Table::row_t bob = friends.put("200", "Bob Example");
+    friends.put("300", "Carol Stranger");
+
+    CHECK(!friends.has_own_friends());
+    friends.set_own_friends(std::vector<Table::row_t>{alice, bob});
+    CHECK(friends.has_own_friends());
+    CHECK(friends.find_own_friend("Alice Example") == alice);
+    CHECK(friends.find_own_friend("Bob Example") == bob);
+    CHECK_EQUAL("Bob Example", friends.get_name(bob));
+
+    // Only the user's own friends are indexed by name
+    CHECK(!friends.find_own_friend("Carol Stranger"));
+    CHECK(!friends.find_own_friend("Nobody"));
+}
+
+TEST(albums_are_found_by_name_within_a_listing) {
+    StringArena arena;
+    AlbumTable albums(arena);
+    Table::row_t mine = albums.put("10", "Holidays", 100);
+    Table::row_t theirs = albums.put("20", "Holidays", 200);
+    albums.set_listing("me", std::vector<Table::row_t>{mine});
+    albums.set_listing("friend", std::vector<Table::row_t>{theirs});
+
+    CHECK(albums.find_by_name("me", "Holidays") == mine);
+    CHECK(albums.find_by_name("friend", "Holidays") == theirs);
+    CHECK(!albums.find_by_name("me", "Work"));
+
+    CHECK_EQUAL(mine, albums.put("10", "Work", 300));
+    CHECK(albums.find_by_name("me", "Work") == mine);
+    CHECK_EQUAL("Work", albums.get_name(mine));
+    CHECK_EQUAL(300, albums.get_updated_time(mine));
+}
+
+// Measures what each cached status costs beyond its strings, which decides
+// how many fit in memory
+TEST(statuses_cost_little_beyond_their_strings) {
+    StringArena arena;
+    StatusTable statuses(arena);
+    const std::size_t count = 100000;
+    std::size_t string_bytes = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        std::string id = "100001234567890_" + std::to_string(10150145806225128 + i);
+        std::string message = "Status number " + std::to_string(i) +
+            ", long enough to look like what people actually write";
+        statuses.put(id, static_cast<int64_t>(1400000000 + i), message);
+        string_bytes += id.size() + message.size();
+    }
+
+    // The table counts the bytes its strings take up in the arena
+    std::size_t usage = statuses.memory_usage();
+    std::size_t overhead = (usage - string_bytes) / count;
+    std::cout << "statuses: " << usage / count << " bytes per entry, "
+              << overhead << " beyond the strings" << std::endl;
+    CHECK(usage > string_bytes);
+    CHECK(overhead < 64);
+}
@@ -0,0 +1,50 @@
+#include "Test.h"
+
+#include <exception>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+static std::vector<std::pair<std::string, std::function<void()>>>& get_cases() {
+    // Cases register themselves during static initialization, so the list
+    // must exist before the first of them
+    static std::vector<std::pair<std::string, std::function<void()>>> cases;
+    return cases;
+}
+
+static unsigned failures = 0;
+
+TestCase::TestCase(const std::string &name, const std::function<void()> body) {
+    get_cases().push_back(std::make_pair(name, body));
+}
+
+void TestCase::fail(const char *file, const int line, const std::string &message) {
+    std::cerr << file << ":" << line << ": " << message << std::endl;
+    ++failures;
+}
+
+int TestCase::run_all() {
+    unsigned failed_cases = 0;
+    for (auto &test : get_cases()) {
+        unsigned previous_failures = failures;
+        try {
+            test.second();
+        } catch (std::exception &e) {
+            fail(test.first.c_str(), 0, std::string("uncaught exception: ") + e.what());
+        }
+
+        bool passed = failures == previous_failures;
+        if (!passed) {
+            ++failed_cases;
+        }
+        std::cout << (passed ? "PASS " : "FAIL ") << test.first << std::endl;
+    }
+
+    std::cout << get_cases().size() - failed_cases << "/" << get_cases().size()
+              << " tests passed" << std::endl;
+    return failed_cases == 0 ? 0 : 1;
+}
+
+int main() {
+    return TestCase::run_all();
+}
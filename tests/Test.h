@@ -0,0 +1,45 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <functional>
+#include <sstream>
+#include <string>
+
+// A minimal test runner. Each test file declares its cases with TEST, and
+// the runner's main() runs them all in the order they were declared.
+class TestCase {
+    public:
+        TestCase(const std::string&, const std::function<void()>);
+        static int run_all();
+
+        // Records a failed check. The test keeps running, so that one run
+        // reports every check that failed.
+        static void fail(const char*, const int, const std::string&);
+};
+
+template<typename T, typename U>
+void check_equal(const char *file, const int line, const char *expression,
+                 const T &expected, const U &actual) {
+    if (!(expected == actual)) {
+        std::ostringstream message;
+        message << expression << ": expected " << expected << ", got " << actual;
+        TestCase::fail(file, line, message.str());
+    }
+}
+
+#define TEST(name) \
+    static void name(); \
+    static TestCase name##_case(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            TestCase::fail(__FILE__, __LINE__, #condition); \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+    check_equal(__FILE__, __LINE__, #actual, expected, actual)
+
+#endif // TEST_H
@@ -0,0 +1,322 @@
+#include "Test.h"
+#include "LocalServer.h"
+#include "Transport.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::chrono::milliseconds time_since(const std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+}
+
+TEST(retries_server_errors) {
+    std::atomic<int> hits(0);
+    LocalServer server([&hits](const HttpRequest&) {
+        return ++hits < 3 ? HttpReply(500) : HttpReply(200, "{\"ok\":true}");
+    });
+
+    Transport transport;
+    transport.set_hedging(false);
+    Response response = transport.perform("GET", server.get_url() + "/me");
+    CHECK_EQUAL(200, response.status);
+    CHECK_EQUAL("{\"ok\":true}", response.body);
+    CHECK_EQUAL(3, hits.load());
+}
+
+TEST(retries_do_not_log_the_access_token) {
+    std::atomic<int> hits(0);
+    LocalServer server([&hits](const HttpRequest&) {
+        return ++hits < 2 ? HttpReply(500) : HttpReply();
+    });
+
+    Transport transport;
+    transport.set_hedging(false);
+    std::ostringstream log;
+    std::streambuf *previous = std::cerr.rdbuf(log.rdbuf());
+    Response response = transport.perform("GET",
+        server.get_url() + "/me/statuses?access_token=secret-token&limit=25");
+    std::cerr.rdbuf(previous);
+
+    CHECK_EQUAL(200, response.status);
+    CHECK(log.str().find("/me/statuses") != std::string::npos);
+    CHECK(log.str().find("secret-token") == std::string::npos);
+}
+
+TEST(gives_up_after_max_retries) {
+    std::atomic<int> hits(0);
+    LocalServer server([&hits](const HttpRequest&) {
+        ++hits;
+        return HttpReply(503);
+    });
+
+    Transport transport;
+    transport.set_hedging(false);
+    transport.set_max_retries(2);
+    Response response = transport.perform("GET", server.get_url() + "/me");
+    CHECK_EQUAL(503, response.status);
+    CHECK_EQUAL(3, hits.load());
+}
+
+TEST(does_not_retry_client_errors) {
+    std::atomic<int> hits(0);
+    LocalServer server([&hits](const HttpRequest&) {
+        ++hits;
+        return HttpReply(400, "{\"error\":{}}");
+    });
+
+    Transport transport;
+    Response response = transport.perform("GET", server.get_url() + "/me");
+    CHECK_EQUAL(400, response.status);
+    CHECK(!response.should_retry());
+    CHECK_EQUAL(1, hits.load());
+}
+
+TEST(does_not_retry_posts) {
+    std::atomic<int> hits(0);
+    LocalServer server([&hits](const HttpRequest&) {
+        ++hits;
+        return HttpReply(500);
+    });
+
+    Transport transport;
+    Response response = transport.perform("POST", server.get_url() + "/me/feed");
+    CHECK_EQUAL(500, response.status);
+    CHECK_EQUAL(1, hits.load());
+    CHECK_EQUAL(1u, server.get_requests().size());
+    CHECK_EQUAL("POST", server.get_requests().front().method);
+}
+
+TEST(deadline_bounds_slow_requests) {
+    LocalServer server([](const HttpRequest&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        return HttpReply();
+    });
+
+    Transport transport;
+    transport.set_deadline(std::chrono::milliseconds(200));
+    auto start = std::chrono::steady_clock::now();
+    Response response = transport.perform("GET", server.get_url() + "/me");
+    CHECK(response.timed_out);
+    CHECK(!response.should_retry());
+    CHECK(time_since(start) < std::chrono::milliseconds(800));
+}
+
+TEST(operation_deadline_bounds_requests) {
+    LocalServer server([](const HttpRequest&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        return HttpReply();
+    });
+
+    Transport transport;
+    auto start = std::chrono::steady_clock::now();
+    Response response;
+    {
+        OperationDeadline deadline(std::chrono::milliseconds(200));
+        response = transport.perform("GET", server.get_url() + "/me");
+    }
+    CHECK(response.timed_out);
+    CHECK(time_since(start) < std::chrono::milliseconds(800));
+    CHECK(!OperationDeadline::is_active());
+}
+
+TEST(operation_deadline_bounds_several_requests_together) {
+    std::atomic<int> hits(0);
+    LocalServer server([&hits](const HttpRequest&) {
+        ++hits;
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        return HttpReply();
+    });
+
+    // Each request fits within the transport's deadline, but not all of them
+    // within the operation's
+    Transport transport;
+    transport.set_hedging(false);
+    transport.set_deadline(std::chrono::milliseconds(5000));
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Response> responses;
+    {
+        OperationDeadline deadline(std::chrono::milliseconds(500));
+        for (int i = 0; i < 3; ++i) {
+            responses.push_back(transport.perform("GET", server.get_url() + "/me"));
+        }
+    }
+
+    CHECK(time_since(start) < std::chrono::milliseconds(1000));
+    CHECK_EQUAL(200, responses[0].status);
+    CHECK(responses[1].timed_out);
+    CHECK(responses[2].timed_out);
+
+    // The last request isn't even sent
+    CHECK_EQUAL(2, hits.load());
+}
+
+TEST(interrupts_end_requests_in_progress) {
+    LocalServer server([](const HttpRequest&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+        return HttpReply();
+    });
+
+    std::atomic<bool> interrupted(false);
+    Transport transport;
+    transport.set_interrupt_check([&interrupted]() { return interrupted.load(); });
+    std::thread interrupter([&interrupted]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        interrupted = true;
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    Response response;
+    {
+        OperationDeadline deadline(std::chrono::milliseconds(5000));
+        response = transport.perform("GET", server.get_url() + "/me");
+    }
+    interrupter.join();
+
+    // The caller doesn't wait for the server to answer
+    CHECK(response.interrupted);
+    CHECK(!response.timed_out);
+    CHECK(!response.should_retry());
+    CHECK(time_since(start) < std::chrono::milliseconds(1000));
+}
+
+TEST(interrupts_only_apply_to_operations) {
+    LocalServer server([](const HttpRequest&) { return HttpReply(); });
+
+    // Threads outside of an operation have no one to interrupt them
+    Transport transport;
+    transport.set_interrupt_check([]() { return true; });
+    Response response = transport.perform("GET", server.get_url() + "/me");
+    CHECK(!response.interrupted);
+    CHECK_EQUAL(200, response.status);
+}
+
+TEST(hedges_requests_slower_than_usual) {
+    std::atomic<int> slow_hits(0);
+    LocalServer server([&slow_hits](const HttpRequest &request) {
+        // Only the first attempt at the slow path stalls, like a request
+        // stuck behind a bad connection
+        if (request.get_path() == "/slow" && ++slow_hits == 1) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+            return HttpReply(200, "{\"attempt\":\"first\"}");
+        }
+        return HttpReply(200, "{\"attempt\":\"hedge\"}");
+    });
+
+    Transport transport;
+    transport.set_max_retries(0);
+
+    // Hedging waits until enough latencies are known
+    for (int i = 0; i < 20; ++i) {
+        CHECK_EQUAL(200, transport.perform("GET", server.get_url() + "/fast").status);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    Response response = transport.perform("GET", server.get_url() + "/slow");
+    CHECK_EQUAL(200, response.status);
+    CHECK_EQUAL("{\"attempt\":\"hedge\"}", response.body);
+    CHECK_EQUAL(2, slow_hits.load());
+    CHECK(time_since(start) < std::chrono::milliseconds(1000));
+}
+
+TEST(does_not_hedge_posts) {
+    std::atomic<int> hits(0);
+    LocalServer server([&hits](const HttpRequest &request) {
+        if (request.method == "POST") {
+            ++hits;
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        }
+        return HttpReply();
+    });
+
+    Transport transport;
+    for (int i = 0; i < 20; ++i) {
+        transport.perform("GET", server.get_url() + "/fast");
+    }
+
+    CHECK_EQUAL(200, transport.perform("POST", server.get_url() + "/me/feed").status);
+    CHECK_EQUAL(1, hits.load());
+}
+
+TEST(background_requests_wait_for_interactive_ones) {
+    LocalServer server([](const HttpRequest &request) {
+        if (request.get_path() == "/interactive") {
+            std::this_thread::sleep_for(std::chrono::milliseconds(300));
+        }
+        return HttpReply();
+    });
+
+    Transport transport;
+    std::thread interactive([&]() {
+        transport.perform("GET", server.get_url() + "/interactive");
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    Response response;
+    std::thread background([&]() {
+        Transport::set_background_thread(true);
+        response = transport.perform("GET", server.get_url() + "/background");
+    });
+    interactive.join();
+    background.join();
+
+    CHECK_EQUAL(200, response.status);
+    std::vector<HttpRequest> requests = server.get_requests();
+    CHECK_EQUAL(2u, requests.size());
+    CHECK_EQUAL("/background", requests.back().get_path());
+}
+
+TEST(background_requests_can_be_stopped) {
+    LocalServer server([](const HttpRequest &request) {
+        if (request.get_path() == "/interactive") {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        }
+        return HttpReply();
+    });
+
+    Transport transport;
+    std::thread interactive([&]() {
+        transport.perform("GET", server.get_url() + "/interactive");
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // The background request is stuck behind the interactive one until the
+    // work it belongs to is stopped
+    std::atomic<bool> stopped(false);
+    Response response;
+    auto start = std::chrono::steady_clock::now();
+    std::thread background([&]() {
+        Transport::set_background_thread(true, [&stopped]() { return stopped.load(); });
+        response = transport.perform("GET", server.get_url() + "/background");
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    stopped = true;
+    background.join();
+    auto elapsed = time_since(start);
+    interactive.join();
+
+    CHECK(response.interrupted);
+    CHECK(elapsed < std::chrono::milliseconds(800));
+    CHECK_EQUAL(1u, server.get_requests().size());
+}
+
+TEST(rate_limit_spaces_requests) {
+    LocalServer server([](const HttpRequest&) {
+        return HttpReply();
+    });
+
+    Transport transport;
+    transport.set_max_rate(10);
+
+    // The bucket starts empty, so each request waits for its permit
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 3; ++i) {
+        CHECK_EQUAL(200, transport.perform("GET", server.get_url() + "/me").status);
+    }
+    CHECK(time_since(start) >= std::chrono::milliseconds(250));
+}
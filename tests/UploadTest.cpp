@@ -0,0 +1,209 @@
+#include "Test.h"
+#include "LocalServer.h"
+#include "Transport.h"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const std::string BOUNDARY = "fbfs-upload-boundary-7d3c9a1e";
+static const std::string PREAMBLE = "--" + BOUNDARY + "\r\n"
+    "Content-Disposition: form-data; name=\"source\"; filename=\"cat.jpg\"\r\n"
+    "Content-Type: application/octet-stream\r\n\r\n";
+static const std::string EPILOGUE = "\r\n--" + BOUNDARY + "--\r\n";
+
+// More than the upload buffers, so that writers have to wait for readers
+static const std::size_t LARGE_FILE_SIZE = 3 << 20;
+
+static std::string make_data(const std::size_t size) {
+    std::string data(size, '\0');
+    for (std::size_t i = 0; i < size; ++i) {
+        data[i] = static_cast<char>((i * 31 + i / 4096) & 0xff);
+    }
+    return data;
+}
+
+// Reads the body the way curl does, a chunk at a time, until it ends
+static std::string read_body(Upload &upload, const std::size_t chunk_size) {
+    std::string body;
+    std::vector<char> chunk(chunk_size);
+    std::size_t count;
+    while ((count = read_upload_body(chunk.data(), 1, chunk.size(), &upload)) > 0) {
+        body.append(chunk.data(), count);
+    }
+    return body;
+}
+
+static std::chrono::milliseconds time_since(const std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+}
+
+TEST(body_frames_the_written_data) {
+    Upload upload(nullptr, std::function<bool()>(), "source", "cat.jpg");
+    CHECK(upload.write("hello ", 6));
+    CHECK(upload.write("world", 5));
+    upload.close();
+
+    CHECK_EQUAL(11u, upload.size());
+    CHECK_EQUAL(PREAMBLE + "hello world" + EPILOGUE, read_body(upload, 4096));
+
+    // Nothing more can be written once the body has ended
+    CHECK(!upload.write("!", 1));
+}
+
+TEST(body_is_the_same_whatever_the_read_size) {
+    std::string data = make_data(10000);
+    for (std::size_t chunk_size : {1, 7, 100, 65536}) {
+        Upload upload(nullptr, std::function<bool()>(), "source", "cat.jpg");
+        CHECK(upload.write(data.data(), data.size()));
+        upload.close();
+        CHECK(read_body(upload, chunk_size) == PREAMBLE + data + EPILOGUE);
+    }
+}
+
+TEST(empty_files_are_only_framing) {
+    Upload upload(nullptr, std::function<bool()>(), "source", "cat.jpg");
+    upload.close();
+    CHECK_EQUAL(PREAMBLE + EPILOGUE, read_body(upload, 4096));
+    CHECK_EQUAL(0u, upload.size());
+}
+
+TEST(filenames_cannot_end_the_header) {
+    Upload upload(nullptr, std::function<bool()>(), "source", "a \"cat\"\r\n.jpg");
+    upload.close();
+    std::string body = read_body(upload, 4096);
+    CHECK(body.find("filename=\"a _cat___.jpg\"\r\n") != std::string::npos);
+}
+
+TEST(writers_wait_for_readers_to_make_room) {
+    Upload upload(nullptr, std::function<bool()>(), "source", "cat.jpg");
+    std::string data = make_data(LARGE_FILE_SIZE);
+    bool written = false;
+    std::thread writer([&]() {
+        written = upload.write(data.data(), data.size());
+        upload.close();
+    });
+
+    // The writer fills the buffer and waits there
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    std::size_t buffered = upload.size();
+    CHECK(buffered > 0);
+    CHECK(buffered < data.size());
+
+    // An odd read size makes reads straddle the end of the ring buffer
+    std::string body = read_body(upload, 7001);
+    writer.join();
+
+    CHECK(written);
+    CHECK_EQUAL(data.size(), upload.size());
+    CHECK_EQUAL(PREAMBLE.size() + data.size() + EPILOGUE.size(), body.size());
+    CHECK(body == PREAMBLE + data + EPILOGUE);
+}
+
+TEST(blocked_writers_give_up_at_the_operation_deadline) {
+    Upload upload(nullptr, std::function<bool()>(), "source", "cat.jpg");
+    std::string data = make_data(LARGE_FILE_SIZE);
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        OperationDeadline deadline(std::chrono::milliseconds(200));
+        CHECK(!upload.write(data.data(), data.size()));
+    }
+    CHECK(time_since(start) < std::chrono::milliseconds(1000));
+}
+
+TEST(aborted_uploads_refuse_writes) {
+    Upload upload(nullptr, std::function<bool()>(), "source", "cat.jpg");
+    CHECK(upload.write("hello", 5));
+    upload.abort();
+    CHECK(!upload.write("hello", 5));
+}
+
+TEST(uploads_stream_to_the_server) {
+    LocalServer server([](const HttpRequest &request) {
+        return HttpReply(200, "{\"id\":\"" + std::to_string(request.body.size()) + "\"}");
+    });
+
+    Transport transport;
+    Response failure;
+    std::unique_ptr<Upload> upload = transport.start_upload(
+        server.get_url() + "/123/photos", "source", "cat.jpg", failure);
+    CHECK(upload);
+    if (!upload) {
+        return;
+    }
+
+    std::string data = make_data(LARGE_FILE_SIZE);
+    for (std::size_t offset = 0; offset < data.size(); offset += 4096) {
+        CHECK(upload->write(data.data() + offset, 4096));
+    }
+    Response response = upload->finish();
+
+    std::string body = PREAMBLE + data + EPILOGUE;
+    CHECK_EQUAL("", response.error);
+    CHECK_EQUAL(200, response.status);
+    CHECK_EQUAL("{\"id\":\"" + std::to_string(body.size()) + "\"}", response.body);
+
+    std::vector<HttpRequest> requests = server.get_requests();
+    CHECK_EQUAL(1u, requests.size());
+    if (requests.size() == 1) {
+        CHECK_EQUAL("POST", requests[0].method);
+        CHECK_EQUAL("/123/photos", requests[0].get_path());
+        CHECK_EQUAL("chunked", requests[0].headers["transfer-encoding"]);
+        CHECK_EQUAL("multipart/form-data; boundary=" + BOUNDARY,
+                    requests[0].headers["content-type"]);
+        CHECK(requests[0].body == body);
+    }
+}
+
+TEST(finish_gives_up_on_servers_that_never_answer) {
+    LocalServer server([](const HttpRequest&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+        return HttpReply();
+    });
+
+    Transport transport;
+    transport.set_deadline(std::chrono::milliseconds(300));
+    Response failure;
+    std::unique_ptr<Upload> upload = transport.start_upload(
+        server.get_url() + "/123/photos", "source", "cat.jpg", failure);
+    CHECK(upload);
+    if (!upload) {
+        return;
+    }
+
+    CHECK(upload->write("hello", 5));
+    auto start = std::chrono::steady_clock::now();
+    Response response = upload->finish();
+    CHECK(response.timed_out);
+    CHECK(!response.error.empty());
+    CHECK(time_since(start) < std::chrono::milliseconds(1500));
+}
+
+TEST(uploads_to_unreachable_servers_fail) {
+    std::string url;
+    {
+        LocalServer server([](const HttpRequest&) { return HttpReply(); });
+        url = server.get_url();
+    }
+
+    Transport transport;
+    Response failure;
+    std::unique_ptr<Upload> upload = transport.start_upload(
+        url + "/123/photos", "source", "cat.jpg", failure);
+    CHECK(upload);
+    if (!upload) {
+        return;
+    }
+
+    // Writes may be buffered before the connection fails, but the upload
+    // can't succeed
+    upload->write("hello", 5);
+    Response response = upload->finish();
+    CHECK(!response.error.empty());
+    CHECK_EQUAL(0, response.status);
+}